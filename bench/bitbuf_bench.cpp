@@ -0,0 +1,1468 @@
+// Microbenchmarks for the bitbuf library. Every case first checks that the fast path produces
+// the same bytes as the code it replaces, then times both.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include "bitbuf/bitbuf.h"
+#include "packetschema.hpp"
+
+static constexpr int BENCH_BUFFER_SIZE = 1400;
+static constexpr int BENCH_ITERATIONS = 200000;
+
+//Keeps the compiler from throwing away the written buffers
+static volatile unsigned int g_Sink;
+
+static const char* const BENCH_STRINGS[] = {
+	"Counter-Strike: Global Offensive",
+	"de_dust2",
+	"csgo",
+	"empty,secure",
+	"",
+	"A somewhat longer server name that is still well within the limits of A2S_INFO",
+};
+
+static const unsigned char BENCH_BLOB[] = {
+	0x01, 0x80, 0xff, 0x7f, 0x00, 0x42, 0x13, 0x37, 0xde, 0xad, 0xbe, 0xef, 0x11, 0x22, 0x33, 0x44,
+	0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a,
+	0x69, 0x78, 0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60,
+};
+
+//A connectionless reply, roughly S2A_INFO_SRC, written through the public writers
+template<typename Writer>
+static void WriteFast(Writer& buf)
+{
+	buf.WriteLong(-1);
+	buf.WriteByte('I');
+	for (auto str : BENCH_STRINGS)
+		buf.WriteString(str);
+	buf.WriteShort(730);
+	buf.WriteWord(27015);
+	buf.WriteWord(0xBEEF);
+	buf.WriteLongLong(76561197960265728LL);
+	buf.WriteFloat(1.5f);
+	buf.WriteBytes(BENCH_BLOB, sizeof(BENCH_BLOB));
+	buf.WriteChar(-2);
+}
+
+//The same reply through the bit packing every writer used before the aligned fast paths
+static void WriteGeneric(bf_write& buf)
+{
+	buf.WriteSBitLong(-1, 32);
+	buf.WriteUBitLong('I', 8);
+	for (auto str : BENCH_STRINGS)
+	{
+		do
+		{
+			buf.WriteSBitLong(*str, 8);
+		} while (*str++ != 0);
+	}
+	buf.WriteSBitLong(730, 16);
+	buf.WriteUBitLong(27015, 16);
+	buf.WriteUBitLong(0xBEEF, 16);
+
+	int64 steamId = 76561197960265728LL;
+	buf.WriteUBitLong((uint32)steamId, 32);
+	buf.WriteUBitLong((uint32)(steamId >> 32), 32);
+
+	float value = 1.5f;
+	uint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	buf.WriteUBitLong(bits, 32);
+
+	for (auto byte : BENCH_BLOB)
+		buf.WriteUBitLong(byte, 8);
+	buf.WriteSBitLong(-2, 8);
+}
+
+template<typename Fn>
+static double Measure(int startBit, Fn&& write)
+{
+	char data[BENCH_BUFFER_SIZE];
+	memset(data, 0, sizeof(data));
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ITERATIONS; ++i)
+	{
+		bf_write buf(data, sizeof(data));
+		buf.SeekToBit(startBit);
+		write(buf);
+		g_Sink += buf.GetNumBitsWritten();
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	return std::chrono::duration<double, std::nano>(elapsed).count() / BENCH_ITERATIONS;
+}
+
+//Only the bits up to the cursor count, the bit packing may leave junk behind it
+static bool SameBits(const bf_write& a, const bf_write& b)
+{
+	int nBits = a.GetNumBitsWritten();
+	if (nBits != b.GetNumBitsWritten())
+		return false;
+
+	if (memcmp(a.GetData(), b.GetData(), nBits >> 3) != 0)
+		return false;
+
+	int mask = (1 << (nBits & 7)) - 1;
+	return (nBits & 7) == 0 || ((a.GetData()[nBits >> 3] ^ b.GetData()[nBits >> 3]) & mask) == 0;
+}
+
+static bool CheckSame(int startBit)
+{
+	char fast[BENCH_BUFFER_SIZE], generic[BENCH_BUFFER_SIZE];
+	memset(fast, 0, sizeof(fast));
+	memset(generic, 0, sizeof(generic));
+
+	bf_write fastBuf(fast, sizeof(fast));
+	bf_write genericBuf(generic, sizeof(generic));
+	fastBuf.SeekToBit(startBit);
+	genericBuf.SeekToBit(startBit);
+
+	WriteFast(fastBuf);
+	WriteGeneric(genericBuf);
+
+	return SameBits(fastBuf, genericBuf);
+}
+
+//Bit fields and varints, the part of bf_write_reserved the reply above doesn't touch
+template<typename Writer>
+static void WriteReservedBits(Writer& buf)
+{
+	buf.WriteOneBit(1);
+	buf.WriteUBitLong(0x5A5, 11);
+	buf.WriteSBitLong(-5, 7);
+	buf.WriteSBitLong(-123456, 32);
+	buf.WriteVarInt32(300);
+	buf.WriteVarInt32(0xFFFFFFFF);
+	buf.WriteVarInt64(0x123456789ABCDEFULL);
+	buf.WriteShort(-30000);
+	buf.WriteChar(-128);
+	buf.WriteString(BENCH_STRINGS[1]);
+}
+
+static int ReservedReplyBits()
+{
+	char data[BENCH_BUFFER_SIZE];
+	bf_write buf(data, sizeof(data));
+	WriteFast(buf);
+	WriteReservedBits(buf);
+	return buf.GetNumBitsWritten();
+}
+
+//The reply through one Reserve, then the writers that don't check
+static void WriteReserved(bf_write& buf)
+{
+	static const int nBits = ReservedReplyBits();
+	if (auto reserved = buf.Reserve(nBits))
+	{
+		WriteFast(reserved);
+		WriteReservedBits(reserved);
+	}
+}
+
+static bool CheckReserved(int startBit)
+{
+	char checked[BENCH_BUFFER_SIZE], reserved[BENCH_BUFFER_SIZE];
+	memset(checked, 0, sizeof(checked));
+	memset(reserved, 0, sizeof(reserved));
+
+	bf_write checkedBuf(checked, sizeof(checked));
+	bf_write reservedBuf(reserved, sizeof(reserved));
+	checkedBuf.SeekToBit(startBit);
+	reservedBuf.SeekToBit(startBit);
+
+	WriteFast(checkedBuf);
+	WriteReservedBits(checkedBuf);
+	WriteReserved(reservedBuf);
+	if (checkedBuf.IsOverflowed() || reservedBuf.IsOverflowed() || !SameBits(checkedBuf, reservedBuf))
+		return false;
+
+	//A reservation that doesn't fit writes nothing and overflows the buffer
+	char small[16];
+	bf_write smallBuf(small, sizeof(small));
+	smallBuf.SeekToBit(startBit);
+	WriteReserved(smallBuf);
+	return smallBuf.IsOverflowed() && smallBuf.GetNumBitsWritten() == startBit && !smallBuf.Reserve(-1);
+}
+
+//A reply that doesn't fit has to overflow the same way on both paths
+static bool CheckOverflow()
+{
+	char fast[16], generic[16];
+	memset(fast, 0, sizeof(fast));
+	memset(generic, 0, sizeof(generic));
+
+	bf_write fastBuf(fast, sizeof(fast));
+	bf_write genericBuf(generic, sizeof(generic));
+	fastBuf.WriteLong(-1);
+	fastBuf.WriteString(BENCH_STRINGS[0]);
+	genericBuf.WriteLong(-1);
+	for (auto str = BENCH_STRINGS[0]; ; ++str)
+	{
+		genericBuf.WriteSBitLong(*str, 8);
+		if (!*str)
+			break;
+	}
+
+	return fastBuf.IsOverflowed() && genericBuf.IsOverflowed() && SameBits(fastBuf, genericBuf);
+}
+
+//Words with the top bit set come back whole from every writer, aligned or not
+static bool CheckWords()
+{
+	static unsigned char data[2][0x8000 * 2 + 8];
+
+	for (int startBit : { 0, 8, 3 })
+	{
+		memset(data, 0, sizeof(data));
+		bf_write buf(data[0], sizeof(data[0]));
+		CBitWrite64 buf64(data[1], sizeof(data[1]));
+		if (startBit)
+		{
+			buf.WriteUBitLong(0, startBit);
+			buf64.WriteUBitLong(0, startBit);
+		}
+
+		for (unsigned int val = 0x8000; val <= 0xFFFF; ++val)
+		{
+			buf.WriteWord(val);
+			buf64.WriteWord(val);
+		}
+		buf64.Finish();
+
+		if (buf.IsOverflowed() || buf64.IsOverflowed())
+			return false;
+
+		for (auto* pData : data)
+		{
+			old_bf_read in(pData, sizeof(data[0]));
+			in.Seek(startBit);
+			for (unsigned int val = 0x8000; val <= 0xFFFF; ++val)
+			{
+				if (in.ReadWord() != static_cast<int>(val))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+//S2A_INFO_SRC field by field, the way the info cache wrote it before the schemas
+static void WriteInfoFields(bf_write& buf)
+{
+	buf.WriteLong(CONNECTIONLESS_HEADER);
+	buf.WriteByte(S2A_INFO_SRC);
+	buf.WriteByte(17);
+	for (int i = 0; i < 4; ++i)
+		buf.WriteString(BENCH_STRINGS[i]);
+	buf.WriteShort(730);
+	for (int value : { 31, 32, 0, static_cast<int>('d'), static_cast<int>('w'), 0, 1 })
+		buf.WriteByte(value);
+	buf.WriteString("1.38.5.5");
+	buf.WriteByte(S2A_EXTRA_DATA_HAS_GAME_PORT | S2A_EXTRA_DATA_HAS_STEAMID | S2A_EXTRA_DATA_GAMEID | S2A_EXTRA_DATA_HAS_GAMETAG_DATA);
+	buf.WriteShort(27015);
+	buf.WriteLongLong(90071996842377216LL);
+	buf.WriteString(BENCH_STRINGS[5]);
+	buf.WriteLongLong(730);
+}
+
+static void WriteInfoSchema(bf_write& buf)
+{
+	S2aInfoSrc::Write(buf, 17, BENCH_STRINGS[0], BENCH_STRINGS[1], BENCH_STRINGS[2], BENCH_STRINGS[3], 730,
+		31, 32, 0, 'd', 'w', 0, 1, "1.38.5.5",
+		S2A_EXTRA_DATA_HAS_GAME_PORT | S2A_EXTRA_DATA_HAS_STEAMID | S2A_EXTRA_DATA_GAMEID | S2A_EXTRA_DATA_HAS_GAMETAG_DATA,
+		27015, 90071996842377216LL, BENCH_STRINGS[5], 730);
+}
+
+//What the mirror pulls out of an S2A_INFO_SRC
+struct InfoFields
+{
+	uint8	m_Protocol = 0;
+	uint8	m_MaxClients = 0;
+	uint8	m_Vac = 0;
+	uint8	m_Edf = 0;
+	char	m_Name[256] = {};
+	char	m_Map[256] = {};
+};
+
+//Field by field into temporary strings, the way the mirror read it before the schemas
+static bool ReadInfoFields(bf_read& buf, InfoFields& fields)
+{
+	char temp[1024];
+	if (buf.ReadLong() != CONNECTIONLESS_HEADER || buf.ReadByte() != S2A_INFO_SRC)
+		return false;
+
+	fields.m_Protocol = buf.ReadByte();
+	buf.ReadString(temp, sizeof(temp));
+	strcpy(fields.m_Name, temp);
+	buf.ReadString(temp, sizeof(temp));
+	strcpy(fields.m_Map, temp);
+	buf.ReadString(temp, sizeof(temp));
+	buf.ReadString(temp, sizeof(temp));
+	buf.ReadShort();
+	buf.ReadByte();
+	fields.m_MaxClients = buf.ReadByte();
+	buf.ReadByte();
+	buf.ReadByte();
+	buf.ReadByte();
+	buf.ReadByte();
+	fields.m_Vac = buf.ReadByte();
+	buf.ReadString(temp, sizeof(temp));
+	fields.m_Edf = buf.ReadByte();
+	return !buf.IsOverflowed();
+}
+
+static bool ReadInfoSchema(bf_read& buf, InfoFields& fields)
+{
+	const char *name, *map;
+	schema::Ignored ignored;
+	if (buf.ReadLong() != CONNECTIONLESS_HEADER || buf.ReadByte() != S2A_INFO_SRC)
+		return false;
+
+	if (!S2aInfoSrcBody::Read(buf, fields.m_Protocol, name, map, ignored, ignored, ignored, ignored,
+		fields.m_MaxClients, ignored, ignored, ignored, ignored, fields.m_Vac, ignored, fields.m_Edf))
+		return false;
+
+	strcpy(fields.m_Name, name);
+	strcpy(fields.m_Map, map);
+	return true;
+}
+
+static bool CheckSchema()
+{
+	char fields[BENCH_BUFFER_SIZE], schema[BENCH_BUFFER_SIZE];
+	memset(fields, 0, sizeof(fields));
+	memset(schema, 0, sizeof(schema));
+
+	bf_write fieldsBuf(fields, sizeof(fields));
+	bf_write schemaBuf(schema, sizeof(schema));
+	WriteInfoFields(fieldsBuf);
+	WriteInfoSchema(schemaBuf);
+	if (!SameBits(fieldsBuf, schemaBuf))
+		return false;
+
+	//Off a byte boundary the schema writes through a reservation
+	char unaligned[2][BENCH_BUFFER_SIZE];
+	memset(unaligned, 0, sizeof(unaligned));
+	bf_write unalignedFields(unaligned[0], BENCH_BUFFER_SIZE);
+	bf_write unalignedSchema(unaligned[1], BENCH_BUFFER_SIZE);
+	unalignedFields.SeekToBit(5);
+	unalignedSchema.SeekToBit(5);
+	WriteInfoFields(unalignedFields);
+	WriteInfoSchema(unalignedSchema);
+	if (unalignedSchema.IsOverflowed() || !SameBits(unalignedFields, unalignedSchema))
+		return false;
+
+	InfoFields a, b;
+	bf_read readA(fields, fieldsBuf.GetNumBytesWritten());
+	bf_read readB(fields, fieldsBuf.GetNumBytesWritten());
+	if (!ReadInfoFields(readA, a) || !ReadInfoSchema(readB, b) || readA.GetNumBitsRead() != readB.GetNumBitsRead())
+		return false;
+
+	//A truncated reply must not decode
+	bf_read truncated(fields, 40);
+	InfoFields c;
+	if (ReadInfoSchema(truncated, c))
+		return false;
+
+	return a.m_Protocol == b.m_Protocol && a.m_MaxClients == b.m_MaxClients && a.m_Vac == b.m_Vac && a.m_Edf == b.m_Edf
+		&& !strcmp(a.m_Name, b.m_Name) && !strcmp(a.m_Map, b.m_Map);
+}
+
+template<typename Fn>
+static double MeasureRead(Fn&& read)
+{
+	char data[BENCH_BUFFER_SIZE];
+	bf_write buf(data, sizeof(data));
+	WriteInfoFields(buf);
+	int length = buf.GetNumBytesWritten();
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ITERATIONS; ++i)
+	{
+		InfoFields fields;
+		bf_read msg(data, length);
+		read(msg, fields);
+		g_Sink += fields.m_MaxClients + fields.m_Name[0];
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	return std::chrono::duration<double, std::nano>(elapsed).count() / BENCH_ITERATIONS;
+}
+
+//Reader cases run over the same pseudo random bits every time
+static unsigned char g_ReadData[BENCH_BUFFER_SIZE];
+static unsigned char g_SparseData[BENCH_BUFFER_SIZE];
+
+static void FillReadData()
+{
+	uint32 x = 0x12345678;
+	for (int i = 0; i < BENCH_BUFFER_SIZE; ++i)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		g_ReadData[i] = static_cast<unsigned char>(x);
+
+		//Roughly one set bit in 32, long runs of zeros
+		g_SparseData[i] = static_cast<unsigned char>(x & (x >> 8) & (x >> 16) & (x >> 24));
+	}
+
+	g_SparseData[BENCH_BUFFER_SIZE - 1] = 0x80;
+}
+
+//PeekUBitLong as it was, a saved reader read bit by bit
+static unsigned int PeekBitByBit(const old_bf_read& buf, int numbits)
+{
+	old_bf_read copy = buf;
+	unsigned int r = 0;
+	for (int i = 0; i < numbits; ++i)
+	{
+		if (copy.ReadOneBit())
+			r |= 1u << i;
+	}
+	return r;
+}
+
+static int CountZerosBitByBit(old_bf_read& buf)
+{
+	int bits = 0;
+	while (!buf.ReadOneBit() && !buf.IsOverflowed())
+		++bits;
+	return bits;
+}
+
+static void ReadBytesOneByOne(old_bf_read& buf, unsigned char* pOut, int nBytes)
+{
+	for (int i = 0; i < nBytes; ++i)
+		pOut[i] = static_cast<unsigned char>(buf.ReadUBitLong(8));
+}
+
+static bool CheckReaders()
+{
+	//Odd bit count so the end of the buffer falls inside a byte
+	const int nBytes = 64;
+	const int nBits = nBytes * 8 - 5;
+
+	for (int startBit = 0; startBit <= nBits; ++startBit)
+	{
+		old_bf_read buf(g_ReadData, nBytes, nBits);
+		buf.Seek(startBit);
+
+		for (int numbits = 1; numbits <= 32; ++numbits)
+		{
+			if (buf.PeekUBitLong(numbits) != PeekBitByBit(buf, numbits) || buf.GetNumBitsRead() != startBit)
+				return false;
+		}
+	}
+
+	for (int startBit = 0; startBit < BENCH_BUFFER_SIZE * 8 - 8; startBit += 3)
+	{
+		old_bf_read a(g_SparseData, BENCH_BUFFER_SIZE), b(g_SparseData, BENCH_BUFFER_SIZE);
+		a.Seek(startBit);
+		b.Seek(startBit);
+		if (a.CountRunOfZeros() != CountZerosBitByBit(b) || a.GetNumBitsRead() != b.GetNumBitsRead())
+			return false;
+	}
+
+	for (int startBit = 0; startBit < 16; ++startBit)
+	{
+		unsigned char fast[200], slow[200];
+		old_bf_read a(g_ReadData, BENCH_BUFFER_SIZE), b(g_ReadData, BENCH_BUFFER_SIZE);
+		a.Seek(startBit);
+		b.Seek(startBit);
+		a.ReadBytes(fast, sizeof(fast));
+		ReadBytesOneByOne(b, slow, sizeof(slow));
+		if (memcmp(fast, slow, sizeof(fast)) != 0 || a.GetNumBitsRead() != b.GetNumBitsRead())
+			return false;
+	}
+
+	return true;
+}
+
+template<typename Fn>
+static double Time(Fn&& fn, int iterations = BENCH_ITERATIONS)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+		fn();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+//-csv prints every row as comma separated values for scripts that track regressions
+static bool g_Csv = false;
+
+static void PrintRow(const char* name, double before, double after)
+{
+	if (g_Csv)
+		printf("compare,%s,%.1f,%.1f,%.2f\n", name, before, after, before / after);
+	else
+		printf("%-28s %12.1f %12.1f %7.2fx\n", name, before, after, before / after);
+}
+
+static void BenchReaders()
+{
+	//Peek 20 bits at 64 offsets
+	auto peek = [](auto&& peekFn)
+	{
+		return Time([&]
+		{
+			old_bf_read buf(g_ReadData, BENCH_BUFFER_SIZE);
+			unsigned int sum = 0;
+			for (int bit = 0; bit < 64 * 13; bit += 13)
+			{
+				buf.Seek(bit);
+				sum += peekFn(buf);
+			}
+			g_Sink += sum;
+		});
+	};
+	PrintRow("PeekUBitLong x64",
+		peek([](old_bf_read& buf) { return PeekBitByBit(buf, 20); }),
+		peek([](old_bf_read& buf) { return buf.PeekUBitLong(20); }));
+
+	//Zero runs through the first 256 bytes of the sparse data
+	auto zeros = [](auto&& countFn)
+	{
+		return Time([&]
+		{
+			old_bf_read buf(g_SparseData, BENCH_BUFFER_SIZE);
+			int sum = 0;
+			while (buf.GetNumBitsRead() < 256 * 8)
+				sum += countFn(buf);
+			g_Sink += sum;
+		});
+	};
+	PrintRow("CountRunOfZeros 256B",
+		zeros([](old_bf_read& buf) { return CountZerosBitByBit(buf); }),
+		zeros([](old_bf_read& buf) { return buf.CountRunOfZeros(); }));
+
+	for (int startBit : { 0, 3 })
+	{
+		unsigned char out[1024];
+		auto bytes = [&](auto&& readFn)
+		{
+			return Time([&]
+			{
+				old_bf_read buf(g_ReadData, BENCH_BUFFER_SIZE);
+				buf.Seek(startBit);
+				readFn(buf);
+				g_Sink += out[startBit];
+			});
+		};
+
+		char name[32];
+		snprintf(name, sizeof(name), "ReadBytes 1KB offset %d", startBit);
+		PrintRow(name,
+			bytes([&](old_bf_read& buf) { ReadBytesOneByOne(buf, out, sizeof(out)); }),
+			bytes([&](old_bf_read& buf) { buf.ReadBytes(out, sizeof(out)); }));
+	}
+}
+
+//A snapshot-like stream of mixed width fields, the same calls on both writers
+template<typename Writer>
+static void WriteMixed(Writer& buf, int count)
+{
+	unsigned int seed = 12345;
+	auto next = [&seed] { seed = seed * 1103515245 + 12345; return seed >> 1; };
+
+	for (int i = 0; i < count; ++i)
+	{
+		auto r = next();
+		float f = static_cast<float>(static_cast<int>(r % 32768) - 16384) / 7.0f;
+		buf.WriteUBitLong(r, 1 + r % 32);
+		buf.WriteBitCoord(f);
+		buf.WriteBitCoordMP(f, kCW_None);
+		buf.WriteBitCoordMP(f * 0.5f, kCW_LowPrecision);
+		buf.WriteBitCoordMP(f, kCW_Integral);
+		buf.WriteBitCellCoord(f < 0 ? -f : f, 15, kCW_None);
+		buf.WriteBitNormal(static_cast<float>(static_cast<int>(r % 2049) - 1024) / 1024.0f);
+		buf.WriteSBitLong(static_cast<int>(r) - 0x40000000, 7 + r % 20);
+		buf.WriteUBitVar(r >> (r % 32));
+		buf.WriteVarInt32(r >> (r % 28));
+		buf.WriteVarInt64((static_cast<uint64>(r) << 33 | next()) >> (r % 64));
+		buf.WriteOneBit(r & 1);
+		buf.WriteByte(r);
+		buf.WriteShort(static_cast<int>(r));
+		buf.WriteLong(static_cast<int>(r));
+		buf.WriteFloat(f);
+		if (i % 8 == 0)
+		{
+			buf.WriteString(BENCH_STRINGS[r % (sizeof(BENCH_STRINGS) / sizeof(BENCH_STRINGS[0]))]);
+			buf.WriteBytes(BENCH_BLOB, r % sizeof(BENCH_BLOB));
+		}
+	}
+}
+
+//Reads back what WriteMixed wrote, every value as its bits. Returns the number of values.
+template<typename Reader>
+static int ReadMixed(Reader& buf, int count, uint64* pOut)
+{
+	unsigned int seed = 12345;
+	auto next = [&seed] { seed = seed * 1103515245 + 12345; return seed >> 1; };
+
+	int n = 0;
+	auto put = [&](auto value)
+	{
+		uint64 bits = 0;
+		memcpy(&bits, &value, sizeof(value));
+		pOut[n++] = bits;
+	};
+
+	for (int i = 0; i < count; ++i)
+	{
+		auto r = next();
+		put(buf.ReadUBitLong(1 + r % 32));
+		put(buf.ReadBitCoord());
+		put(buf.ReadBitCoordMP(kCW_None));
+		put(buf.ReadBitCoordMP(kCW_LowPrecision));
+		put(buf.ReadBitCoordMP(kCW_Integral));
+		put(buf.ReadBitCellCoord(15, kCW_None));
+		put(buf.ReadBitNormal());
+		put(buf.ReadSBitLong(7 + r % 20));
+		put(buf.ReadUBitVar());
+		put(buf.ReadVarInt32());
+		next();
+		put(buf.ReadVarInt64());
+		put(buf.ReadOneBit());
+		put(buf.ReadByte());
+		put(buf.ReadShort());
+		put(buf.ReadLong());
+		put(buf.ReadFloat());
+		if (i % 8 == 0)
+		{
+			char str[256];
+			buf.ReadString(str, sizeof(str));
+			put(strlen(str));
+
+			unsigned char blob[sizeof(BENCH_BLOB)];
+			int length = r % sizeof(BENCH_BLOB);
+			buf.ReadBytes(blob, length);
+			put(length ? blob[0] + blob[length - 1] * 256 : 0);
+		}
+	}
+
+	return n;
+}
+
+template<typename Writer>
+static bool CheckWriter(int startBit, int count, bool expectOverflow)
+{
+	unsigned char expected[BENCH_BUFFER_SIZE];
+	unsigned char actual[BENCH_BUFFER_SIZE];
+	memset(expected, 0, sizeof(expected));
+	memset(actual, 0xCC, sizeof(actual));
+
+	bf_write a(expected, sizeof(expected));
+	Writer b(actual, sizeof(actual));
+	a.WriteUBitLong(0x5A5A5, startBit);
+	b.WriteUBitLong(0x5A5A5, startBit);
+	WriteMixed(a, count);
+	WriteMixed(b, count);
+	b.Finish();
+
+	if (a.IsOverflowed() != expectOverflow || b.IsOverflowed() != expectOverflow)
+		return false;
+
+	if (expectOverflow)
+		return true;
+
+	auto bits = a.GetNumBitsWritten();
+	if (b.GetNumBitsWritten() != bits || memcmp(expected, actual, bits >> 3) != 0)
+		return false;
+
+	auto mask = (1 << (bits & 7)) - 1;
+	return (bits & 7) == 0 || ((expected[bits >> 3] ^ actual[bits >> 3]) & mask) == 0;
+}
+
+static void BenchWriter64()
+{
+	for (int startBit : { 0, 3 })
+	{
+		auto mixed = [&](auto&& writeFn)
+		{
+			return Time([&]
+			{
+				unsigned char data[BENCH_BUFFER_SIZE];
+				writeFn(data);
+				g_Sink += data[startBit];
+			});
+		};
+
+		char name[32];
+		snprintf(name, sizeof(name), "mixed fields offset %d", startBit);
+		PrintRow(name,
+			mixed([&](unsigned char* data)
+			{
+				bf_write buf(data, BENCH_BUFFER_SIZE);
+				buf.WriteUBitLong(0, startBit);
+				WriteMixed(buf, 16);
+			}),
+			mixed([&](unsigned char* data)
+			{
+				CBitWrite64 buf(data, BENCH_BUFFER_SIZE);
+				buf.WriteUBitLong(0, startBit);
+				WriteMixed(buf, 16);
+				buf.Finish();
+			}));
+	}
+}
+
+//Per call throughput of the common writers and readers on every bitbuf class, each case
+//runs THROUGHPUT_VALUES calls on a fresh buffer and reports the time of one call
+static constexpr int THROUGHPUT_VALUES = 256;
+static constexpr int THROUGHPUT_ITERATIONS = 20000;
+static constexpr int THROUGHPUT_BUFFER_SIZE = 16384;
+
+static unsigned int g_Values[THROUGHPUT_VALUES];
+static uint64 g_Values64[THROUGHPUT_VALUES];
+static int g_Widths[THROUGHPUT_VALUES];
+static float g_Coords[THROUGHPUT_VALUES];
+static float g_Normals[THROUGHPUT_VALUES];
+
+static void FillThroughputData()
+{
+	unsigned int seed = 777;
+	auto next = [&seed] { seed = seed * 1103515245 + 12345; return seed >> 1; };
+
+	for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+	{
+		auto r = next();
+		g_Widths[i] = 1 + r % 32;
+		g_Values[i] = (r ^ next() << 1) & (g_Widths[i] == 32 ? ~0u : (1u << g_Widths[i]) - 1);
+		g_Values64[i] = (static_cast<uint64>(next()) << 33 | next()) >> (r % 64);
+		g_Coords[i] = static_cast<float>(static_cast<int>(next() % (1 << 22)) - (1 << 21)) / 128.0f;
+		g_Normals[i] = static_cast<float>(static_cast<int>(next() % 4097) - 2048) / 2048.0f;
+	}
+}
+
+static const char* BenchString(int i)
+{
+	return BENCH_STRINGS[i % (sizeof(BENCH_STRINGS) / sizeof(BENCH_STRINGS[0]))];
+}
+
+//Every write case, the stream each one writes is also what the read cases decode
+#define THROUGHPUT_WRITES(X) \
+	X(WriteUBitLong, buf.WriteUBitLong(g_Values[i], g_Widths[i])) \
+	X(WriteVarInt32, buf.WriteVarInt32(g_Values[i])) \
+	X(WriteVarInt64, buf.WriteVarInt64(g_Values64[i])) \
+	X(WriteBitCoordMP, buf.WriteBitCoordMP(g_Coords[i], kCW_None)) \
+	X(WriteBitNormal, buf.WriteBitNormal(g_Normals[i])) \
+	X(WriteString, buf.WriteString(BenchString(i))) \
+	X(WriteBitCoord, buf.WriteBitCoord(g_Coords[i]))
+
+enum ThroughputWrite
+{
+#define THROUGHPUT_ENUM(name, call) kTW_##name,
+	THROUGHPUT_WRITES(THROUGHPUT_ENUM)
+#undef THROUGHPUT_ENUM
+	kTW_Count
+};
+
+static const char* const THROUGHPUT_WRITE_NAMES[] = {
+#define THROUGHPUT_NAME(name, call) #name,
+	THROUGHPUT_WRITES(THROUGHPUT_NAME)
+#undef THROUGHPUT_NAME
+};
+
+static void FinishWriting(bf_write&) {}
+static void FinishWriting(CBitWrite& buf) { buf.Finish(); }
+static void FinishWriting(CBitWrite64& buf) { buf.Finish(); }
+
+//Writes the offset bits and then the values of one case, returns the number of bits written
+template<typename Writer>
+static int WriteCase(unsigned char* pData, int startBit, int op)
+{
+	Writer buf(pData, THROUGHPUT_BUFFER_SIZE);
+	buf.WriteUBitLong(0, startBit);
+
+	switch (op)
+	{
+#define THROUGHPUT_CASE(name, call) \
+	case kTW_##name: \
+		for (int i = 0; i < THROUGHPUT_VALUES; ++i) \
+			call; \
+		break;
+	THROUGHPUT_WRITES(THROUGHPUT_CASE)
+#undef THROUGHPUT_CASE
+	}
+
+	FinishWriting(buf);
+	return buf.IsOverflowed() ? -1 : buf.GetNumBitsWritten();
+}
+
+enum ThroughputRead
+{
+	kTR_ReadUBitLong,
+	kTR_ReadVarInt32,
+	kTR_ReadBitCoord,
+	kTR_ReadString,
+	kTR_Count
+};
+
+static const char* const THROUGHPUT_READ_NAMES[] = { "ReadUBitLong", "ReadVarInt32", "ReadBitCoord", "ReadString" };
+
+//The write case whose stream each read case decodes
+static const int THROUGHPUT_READ_SOURCE[] = { kTW_WriteUBitLong, kTW_WriteVarInt32, kTW_WriteBitCoord, kTW_WriteString };
+
+//Reads the values of one case into pOut and folds them into a checksum
+template<typename Reader>
+static unsigned int ReadCase(const unsigned char* pData, int startBit, int op, unsigned int* pOut)
+{
+	Reader buf(pData, THROUGHPUT_BUFFER_SIZE);
+	buf.ReadUBitLong(startBit);
+
+	unsigned int sum = 0;
+	for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+	{
+		unsigned int value = 0;
+		switch (op)
+		{
+		case kTR_ReadUBitLong:
+			value = buf.ReadUBitLong(g_Widths[i]);
+			break;
+		case kTR_ReadVarInt32:
+			value = buf.ReadVarInt32();
+			break;
+		case kTR_ReadBitCoord:
+		{
+			float f = buf.ReadBitCoord();
+			memcpy(&value, &f, sizeof(value));
+			break;
+		}
+		case kTR_ReadString:
+		{
+			char str[128];
+			buf.ReadString(str, sizeof(str));
+			value = static_cast<unsigned int>(strlen(str));
+			break;
+		}
+		}
+
+		if (pOut)
+			pOut[i] = value;
+		sum += value;
+	}
+
+	return buf.IsOverflowed() ? 0 : sum;
+}
+
+static unsigned char g_Written[3][THROUGHPUT_BUFFER_SIZE];
+
+//Every writer has to produce the bits bf_write does and every reader has to get the values back
+static bool CheckThroughputCases()
+{
+	for (int startBit : { 0, 3 })
+	{
+		for (int op = 0; op < kTW_Count; ++op)
+		{
+			memset(g_Written, 0, sizeof(g_Written));
+			int bits[] = {
+				WriteCase<bf_write>(g_Written[0], startBit, op),
+				WriteCase<CBitWrite>(g_Written[1], startBit, op),
+				WriteCase<CBitWrite64>(g_Written[2], startBit, op),
+			};
+
+			if (bits[0] < 0)
+				return false;
+
+			for (int i = 1; i < 3; ++i)
+			{
+				auto mask = (1 << (bits[0] & 7)) - 1;
+				if (bits[i] != bits[0] || memcmp(g_Written[0], g_Written[i], bits[0] >> 3) != 0 ||
+					((g_Written[0][bits[0] >> 3] ^ g_Written[i][bits[0] >> 3]) & mask) != 0)
+				{
+					printf("%s from writer %d differs at bit offset %d\n", THROUGHPUT_WRITE_NAMES[op], i, startBit);
+					return false;
+				}
+			}
+		}
+
+		for (int op = 0; op < kTR_Count; ++op)
+		{
+			unsigned int expected[THROUGHPUT_VALUES];
+			unsigned int oldValues[THROUGHPUT_VALUES];
+			unsigned int newValues[THROUGHPUT_VALUES];
+
+			memset(g_Written[0], 0, sizeof(g_Written[0]));
+			WriteCase<bf_write>(g_Written[0], startBit, THROUGHPUT_READ_SOURCE[op]);
+			ReadCase<old_bf_read>(g_Written[0], startBit, op, oldValues);
+			ReadCase<CBitRead>(g_Written[0], startBit, op, newValues);
+
+			for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+			{
+				if (op == kTR_ReadUBitLong || op == kTR_ReadVarInt32)
+					expected[i] = g_Values[i];
+				else if (op == kTR_ReadString)
+					expected[i] = static_cast<unsigned int>(strlen(BenchString(i)));
+				else
+					expected[i] = oldValues[i];
+			}
+
+			if (memcmp(expected, oldValues, sizeof(expected)) != 0 || memcmp(expected, newValues, sizeof(expected)) != 0)
+			{
+				printf("%s differs at bit offset %d\n", THROUGHPUT_READ_NAMES[op], startBit);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void PrintThroughput(const char* op, const char* impl, int startBit, double ns)
+{
+	auto perCall = ns / THROUGHPUT_VALUES;
+	if (g_Csv)
+		printf("throughput,%s,%s,%d,%.2f,%.1f\n", op, impl, startBit, perCall, 1000.0 / perCall);
+	else
+		printf("%-16s %-12s %6d %10.2f %10.1f\n", op, impl, startBit, perCall, 1000.0 / perCall);
+}
+
+static void BenchThroughput()
+{
+	if (g_Csv)
+		printf("throughput,op,impl,offset,ns_per_call,mcalls_per_s\n");
+	else
+		printf("\n%-16s %-12s %6s %10s %10s\n", "op", "class", "offset", "ns/call", "Mcalls/s");
+
+	for (int op = 0; op < kTW_Count; ++op)
+	{
+		for (int startBit : { 0, 3 })
+		{
+			auto write = [&](auto writeFn)
+			{
+				return Time([&] { g_Sink += writeFn(g_Written[0], startBit, op); }, THROUGHPUT_ITERATIONS);
+			};
+
+			PrintThroughput(THROUGHPUT_WRITE_NAMES[op], "bf_write", startBit, write(WriteCase<bf_write>));
+			PrintThroughput(THROUGHPUT_WRITE_NAMES[op], "CBitWrite", startBit, write(WriteCase<CBitWrite>));
+			PrintThroughput(THROUGHPUT_WRITE_NAMES[op], "CBitWrite64", startBit, write(WriteCase<CBitWrite64>));
+		}
+	}
+
+	for (int op = 0; op < kTR_Count; ++op)
+	{
+		for (int startBit : { 0, 3 })
+		{
+			WriteCase<bf_write>(g_Written[0], startBit, THROUGHPUT_READ_SOURCE[op]);
+
+			auto read = [&](auto readFn)
+			{
+				return Time([&] { g_Sink += readFn(g_Written[0], startBit, op, nullptr); }, THROUGHPUT_ITERATIONS);
+			};
+
+			PrintThroughput(THROUGHPUT_READ_NAMES[op], "old_bf_read", startBit, read(ReadCase<old_bf_read>));
+			PrintThroughput(THROUGHPUT_READ_NAMES[op], "CBitRead", startBit, read(ReadCase<CBitRead>));
+		}
+	}
+}
+
+//Coords, cell coords and normals for the array writers and readers, with the values where
+//the encoding changes shape mixed in
+static constexpr int BATCH_VALUES = 1000;
+static constexpr int BATCH_CELL_BITS = 15;
+
+static float g_BatchCoords[BATCH_VALUES];
+static float g_BatchCells[BATCH_VALUES];
+static float g_BatchNormals[BATCH_VALUES];
+
+static void FillBatchData()
+{
+	static const float EDGES[] = {
+		0.0f, -0.0f, 0.03125f, -0.03125f, 0.03f, -0.03f, 0.125f, -0.124f, 1.0f, -1.0f,
+		2047.99f, 2048.0f, -2048.5f, 16383.97f, -16384.0f, 0.0004885f, -0.0004885f, -0.0004886f, 0.99999f, -1.0001f,
+	};
+
+	unsigned int seed = 4242;
+	auto next = [&seed] { seed = seed * 1103515245 + 12345; return seed >> 1; };
+
+	for (int i = 0; i < BATCH_VALUES; ++i)
+	{
+		auto edge = static_cast<size_t>(i) < sizeof(EDGES) / sizeof(EDGES[0]);
+		g_BatchCoords[i] = edge ? EDGES[i] : static_cast<float>(static_cast<int>(next() % (1 << 20)) - (1 << 19)) / 32.0f + static_cast<float>(next() % 1000) / 7777.0f;
+		g_BatchCells[i] = static_cast<float>(next() % (1 << 20)) / 32.0f + static_cast<float>(next() % 1000) / 7777.0f;
+		g_BatchNormals[i] = edge ? EDGES[i] / 2048.0f : static_cast<float>(static_cast<int>(next() % 200001) - 100000) / 100000.0f;
+	}
+}
+
+enum BatchValue
+{
+	BATCH_COORD_MP,
+	BATCH_CELL_COORD,
+	BATCH_NORMAL
+};
+
+template<typename Writer>
+static void WriteBatchLoop(Writer& buf, BatchValue value, EBitCoordType coordType)
+{
+	for (int i = 0; i < BATCH_VALUES; ++i)
+	{
+		if (value == BATCH_COORD_MP)
+			buf.WriteBitCoordMP(g_BatchCoords[i], coordType);
+		else if (value == BATCH_CELL_COORD)
+			buf.WriteBitCellCoord(g_BatchCells[i], BATCH_CELL_BITS, coordType);
+		else
+			buf.WriteBitNormal(g_BatchNormals[i]);
+	}
+}
+
+template<typename Writer>
+static void WriteBatchArray(Writer& buf, BatchValue value, EBitCoordType coordType)
+{
+	if (value == BATCH_COORD_MP)
+		buf.WriteBitCoordMPArray(g_BatchCoords, BATCH_VALUES, coordType);
+	else if (value == BATCH_CELL_COORD)
+		buf.WriteBitCellCoordArray(g_BatchCells, BATCH_VALUES, BATCH_CELL_BITS, coordType);
+	else
+		buf.WriteBitNormalArray(g_BatchNormals, BATCH_VALUES);
+}
+
+static void ReadBatchLoop(CBitRead& buf, BatchValue value, EBitCoordType coordType, float* pOut)
+{
+	for (int i = 0; i < BATCH_VALUES; ++i)
+	{
+		if (value == BATCH_COORD_MP)
+			pOut[i] = buf.ReadBitCoordMP(coordType);
+		else if (value == BATCH_CELL_COORD)
+			pOut[i] = buf.ReadBitCellCoord(BATCH_CELL_BITS, coordType);
+		else
+			pOut[i] = buf.ReadBitNormal();
+	}
+}
+
+static void ReadBatchArray(CBitRead& buf, BatchValue value, EBitCoordType coordType, float* pOut)
+{
+	if (value == BATCH_COORD_MP)
+		buf.ReadBitCoordMPArray(pOut, BATCH_VALUES, coordType);
+	else if (value == BATCH_CELL_COORD)
+		buf.ReadBitCellCoordArray(pOut, BATCH_VALUES, BATCH_CELL_BITS, coordType);
+	else
+		buf.ReadBitNormalArray(pOut, BATCH_VALUES);
+}
+
+//The array writers have to write what the single value writers write and the array reader
+//has to return the same floats, bit for bit, as reading one value at a time
+static bool CheckBatch()
+{
+	static unsigned char expected[THROUGHPUT_BUFFER_SIZE];
+	static unsigned char actual[THROUGHPUT_BUFFER_SIZE];
+	static unsigned char actual64[THROUGHPUT_BUFFER_SIZE];
+
+	for (int startBit : { 0, 3 })
+	{
+		for (auto value : { BATCH_COORD_MP, BATCH_CELL_COORD, BATCH_NORMAL })
+		{
+			for (auto coordType : { kCW_None, kCW_LowPrecision, kCW_Integral })
+			{
+				memset(expected, 0, sizeof(expected));
+				memset(actual, 0, sizeof(actual));
+				memset(actual64, 0, sizeof(actual64));
+
+				bf_write a(expected, sizeof(expected));
+				bf_write b(actual, sizeof(actual));
+				CBitWrite64 c(actual64, sizeof(actual64));
+				a.WriteUBitLong(0x5A5A5, startBit);
+				b.WriteUBitLong(0x5A5A5, startBit);
+				c.WriteUBitLong(0x5A5A5, startBit);
+				WriteBatchLoop(a, value, coordType);
+				WriteBatchArray(b, value, coordType);
+				WriteBatchArray(c, value, coordType);
+				c.Finish();
+
+				if (a.IsOverflowed() || !SameBits(a, b) || c.GetNumBitsWritten() != a.GetNumBitsWritten() ||
+					memcmp(expected, actual64, a.GetNumBytesWritten()) != 0)
+				{
+					printf("Array writer %d differs, coord type %d, bit offset %d\n", value, coordType, startBit);
+					return false;
+				}
+
+				float loop[BATCH_VALUES];
+				float array[BATCH_VALUES];
+				CBitRead readLoop(expected, a.GetNumBytesWritten());
+				CBitRead readArray(expected, a.GetNumBytesWritten());
+				readLoop.ReadUBitLong(startBit);
+				readArray.ReadUBitLong(startBit);
+				ReadBatchLoop(readLoop, value, coordType, loop);
+				ReadBatchArray(readArray, value, coordType, array);
+
+				if (readLoop.IsOverflowed() || readArray.IsOverflowed() || readLoop.GetNumBitsRead() != readArray.GetNumBitsRead() ||
+					memcmp(loop, array, sizeof(loop)) != 0)
+				{
+					printf("Array reader %d differs, coord type %d, bit offset %d\n", value, coordType, startBit);
+					return false;
+				}
+
+				if (value == BATCH_NORMAL)
+					break;
+			}
+		}
+	}
+
+	//Running off the end has to overflow like the single value reader does
+	unsigned char shortData[64] = {};
+	float out[BATCH_VALUES];
+	CBitRead overrun(shortData, sizeof(shortData));
+	overrun.ReadBitNormalArray(out, BATCH_VALUES);
+	return overrun.IsOverflowed();
+}
+
+static void BenchBatch()
+{
+	static const char* const NAMES[] = { "coordMP", "cell coord", "normal" };
+
+	for (auto value : { BATCH_COORD_MP, BATCH_CELL_COORD, BATCH_NORMAL })
+	{
+		static unsigned char data[THROUGHPUT_BUFFER_SIZE];
+		auto write = [&](auto&& writeFn)
+		{
+			return Time([&] { writeFn(); g_Sink += data[7]; }, THROUGHPUT_ITERATIONS);
+		};
+
+		char name[48];
+		snprintf(name, sizeof(name), "%s x1000 bf_write", NAMES[value]);
+		PrintRow(name,
+			write([&] { bf_write buf(data, sizeof(data)); WriteBatchLoop(buf, value, kCW_None); }),
+			write([&] { bf_write buf(data, sizeof(data)); WriteBatchArray(buf, value, kCW_None); }));
+
+		snprintf(name, sizeof(name), "%s x1000 CBitWrite64", NAMES[value]);
+		PrintRow(name,
+			write([&] { CBitWrite64 buf(data, sizeof(data)); WriteBatchLoop(buf, value, kCW_None); buf.Finish(); }),
+			write([&] { CBitWrite64 buf(data, sizeof(data)); WriteBatchArray(buf, value, kCW_None); buf.Finish(); }));
+
+		bf_write source(data, sizeof(data));
+		WriteBatchLoop(source, value, kCW_None);
+
+		float out[BATCH_VALUES];
+		auto read = [&](auto&& readFn)
+		{
+			return Time([&] { CBitRead buf(data, source.GetNumBytesWritten()); readFn(buf); g_Sink += static_cast<unsigned int>(out[7]); }, THROUGHPUT_ITERATIONS);
+		};
+
+		snprintf(name, sizeof(name), "%s x1000 CBitRead", NAMES[value]);
+		PrintRow(name,
+			read([&](CBitRead& buf) { ReadBatchLoop(buf, value, kCW_None, out); }),
+			read([&](CBitRead& buf) { ReadBatchArray(buf, value, kCW_None, out); }));
+	}
+}
+
+//ReadVarInt32/64 as they were, a byte at a time through ReadUBitLong
+template<typename Reader>
+static uint64 ReadVarIntByBytes(Reader& buf, int maxBytes)
+{
+	uint64 result = 0;
+	int count = 0;
+	unsigned int b;
+
+	do
+	{
+		if (count == maxBytes)
+			break;
+		b = buf.ReadUBitLong(8);
+		result |= static_cast<uint64>(b & 0x7F) << (7 * count);
+		++count;
+	} while (b & 0x80);
+
+	//The 32 bit reader shifts in a 32 bit value, the top of the fifth byte falls off
+	return maxBytes == bitbuf::kMaxVarint32Bytes ? static_cast<uint32>(result) : result;
+}
+
+//Random bytes that mostly continue, so there are long and corrupt varints too, read up to and
+//past the end of buffers of every length from every bit offset
+template<typename Reader>
+static bool CheckVarInts()
+{
+	unsigned int seed = 99;
+	auto next = [&seed] { seed = seed * 1103515245 + 12345; return seed >> 1; };
+
+	unsigned char data[48];
+	for (int length = 1; length <= static_cast<int>(sizeof(data)); ++length)
+	{
+		for (int i = 0; i < length; ++i)
+		{
+			auto r = next();
+			data[i] = static_cast<unsigned char>((r & 0x7F) | (r % 5 ? 0x80 : 0));
+		}
+
+		for (int startBit = 0; startBit < 8; ++startBit)
+		{
+			for (int dataBits : { length * 8, length * 8 - 5 })
+			{
+				for (int maxBytes : { bitbuf::kMaxVarint32Bytes, bitbuf::kMaxVarintBytes })
+				{
+					Reader a(data, length, dataBits);
+					Reader b(data, length, dataBits);
+					a.ReadUBitLong(startBit);
+					b.ReadUBitLong(startBit);
+
+					for (int n = 0; n < 12 && !a.IsOverflowed(); ++n)
+					{
+						auto expected = ReadVarIntByBytes(a, maxBytes);
+						auto actual = maxBytes == bitbuf::kMaxVarint32Bytes ? b.ReadVarInt32() : b.ReadVarInt64();
+						if (expected != actual || a.GetNumBitsRead() != b.GetNumBitsRead() || a.IsOverflowed() != b.IsOverflowed())
+							return false;
+					}
+				}
+			}
+		}
+	}
+
+	//The array reader returns what single reads return
+	unsigned char stream[BENCH_BUFFER_SIZE];
+	bf_write out(stream, sizeof(stream));
+	for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+		out.WriteVarInt32(g_Values[i]);
+
+	uint32 values[THROUGHPUT_VALUES];
+	Reader single(stream, out.GetNumBytesWritten());
+	Reader array(stream, out.GetNumBytesWritten());
+	array.ReadVarInt32Array(values, THROUGHPUT_VALUES);
+	for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+	{
+		if (values[i] != single.ReadVarInt32() || values[i] != g_Values[i])
+			return false;
+	}
+
+	return array.GetNumBitsRead() == single.GetNumBitsRead();
+}
+
+static void BenchVarInts()
+{
+	//The varints of the throughput values, mostly 3 to 5 bytes each
+	for (int startBit : { 0, 3 })
+	{
+		static unsigned char stream[BENCH_BUFFER_SIZE];
+		bf_write out(stream, sizeof(stream));
+		out.WriteUBitLong(0, startBit);
+		for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+			out.WriteVarInt32(g_Values[i]);
+
+		auto read = [&](auto&& readFn)
+		{
+			return Time([&] { g_Sink += readFn(); }, THROUGHPUT_ITERATIONS);
+		};
+
+		auto readAll = [&]<typename Reader>(Reader& buf, bool fast)
+		{
+			buf.ReadUBitLong(startBit);
+			unsigned int sum = 0;
+			for (int i = 0; i < THROUGHPUT_VALUES; ++i)
+				sum += fast ? buf.ReadVarInt32() : static_cast<unsigned int>(ReadVarIntByBytes(buf, bitbuf::kMaxVarint32Bytes));
+			return sum;
+		};
+
+		char name[48];
+		snprintf(name, sizeof(name), "varint32 x256 old_bf_read %d", startBit);
+		PrintRow(name,
+			read([&] { old_bf_read buf(stream, out.GetNumBytesWritten()); return readAll(buf, false); }),
+			read([&] { old_bf_read buf(stream, out.GetNumBytesWritten()); return readAll(buf, true); }));
+
+		snprintf(name, sizeof(name), "varint32 x256 CBitRead %d", startBit);
+		PrintRow(name,
+			read([&] { CBitRead buf(stream, out.GetNumBytesWritten()); return readAll(buf, false); }),
+			read([&] { CBitRead buf(stream, out.GetNumBytesWritten()); return readAll(buf, true); }));
+	}
+}
+
+//Strings and blobs from every start byte of a stream, including a last string without its
+//terminator, read as views and as copies
+template<typename Reader>
+static bool CheckStringViews()
+{
+	unsigned char stream[256];
+	bf_write out(stream, sizeof(stream));
+	for (int i = 0; i < 6; ++i)
+	{
+		out.WriteString(BenchString(i));
+		out.WriteBytes(BENCH_BLOB, i * 7);
+	}
+	out.WriteBytes("no terminator", 13);
+	int length = out.GetNumBytesWritten();
+
+	for (int startByte = 0; startByte < length; ++startByte)
+	{
+		for (int dataBits : { length * 8, length * 8 - 5 })
+		{
+			Reader views(stream, length, dataBits);
+			Reader copies(stream, length, dataBits);
+			views.Seek(startByte * 8);
+			copies.Seek(startByte * 8);
+
+			for (int i = 0; !copies.IsOverflowed(); ++i)
+			{
+				char str[256];
+				std::string_view view;
+				bool bytes = i & 1;
+				int nBytes = (i * 5) % 11;
+				bool copied = bytes ? copies.ReadBytes(str, nBytes) : copies.ReadString(str, sizeof(str));
+				bool viewed = bytes ? views.ReadBytesView(view, nBytes) : views.ReadStringView(view);
+
+				if (copied != viewed || copies.IsOverflowed() != views.IsOverflowed())
+					return false;
+				if (copied && (view.size() != (bytes ? static_cast<size_t>(nBytes) : strlen(str)) || memcmp(view.data(), str, view.size())))
+					return false;
+
+				//The reader doesn't move after a failed read, the copy runs to the end instead
+				if (copied && views.GetNumBitsRead() != copies.GetNumBitsRead())
+					return false;
+			}
+		}
+	}
+
+	//Unaligned views fail without moving
+	Reader buf(stream, length);
+	buf.ReadOneBit();
+	std::string_view view;
+	return !buf.ReadStringView(view) && !buf.ReadBytesView(view, 1) && buf.GetNumBitsRead() == 1 && !buf.IsOverflowed();
+}
+
+static void BenchStringViews()
+{
+	//The strings of an info reply, one after another
+	unsigned char stream[BENCH_BUFFER_SIZE];
+	bf_write out(stream, sizeof(stream));
+	for (int i = 0; i < 6; ++i)
+		out.WriteString(BenchString(i));
+
+	auto read = [&](auto&& readFn)
+	{
+		return Time([&]
+		{
+			CBitRead buf(stream, out.GetNumBytesWritten());
+			unsigned int sum = 0;
+			for (int i = 0; i < 6; ++i)
+				sum += readFn(buf);
+			g_Sink += sum;
+		});
+	};
+
+	PrintRow("ReadString x6 CBitRead",
+		read([](CBitRead& buf) { char str[1024]; buf.ReadString(str, sizeof(str)); return static_cast<unsigned int>(str[0]); }),
+		read([](CBitRead& buf) { std::string_view str; buf.ReadStringView(str); return static_cast<unsigned int>(str.size()); }));
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-csv"))
+			g_Csv = true;
+	}
+
+	FillReadData();
+	FillThroughputData();
+	FillBatchData();
+
+	bool ok = CheckOverflow();
+	if (!ok)
+		printf("Overflow behaviour differs from the generic writers\n");
+
+	if (!CheckWords())
+	{
+		printf("Words from 0x8000 to 0xFFFF don't read back as written\n");
+		ok = false;
+	}
+
+	for (int startBit : { 0, 8, 3 })
+	{
+		if (!CheckSame(startBit))
+		{
+			printf("Output differs from the generic writers at bit offset %d\n", startBit);
+			ok = false;
+		}
+	}
+
+	for (int startBit : { 0, 8, 3 })
+	{
+		if (!CheckReserved(startBit))
+		{
+			printf("Reserved writes differ from the checked writers at bit offset %d\n", startBit);
+			ok = false;
+		}
+	}
+
+	if (!CheckSchema())
+	{
+		printf("Packet schemas differ from the field writers and readers\n");
+		ok = false;
+	}
+
+	if (!CheckReaders())
+	{
+		printf("Word-wise readers differ from reading bit by bit\n");
+		ok = false;
+	}
+
+	if (!CheckBatch())
+	{
+		printf("Array coord and normal writers or readers differ from the single value ones\n");
+		ok = false;
+	}
+
+	if (!CheckVarInts<old_bf_read>() || !CheckVarInts<CBitRead>())
+	{
+		printf("Varint fast paths differ from reading a byte at a time\n");
+		ok = false;
+	}
+
+	if (!CheckStringViews<old_bf_read>() || !CheckStringViews<CBitRead>())
+	{
+		printf("String and byte views differ from ReadString and ReadBytes\n");
+		ok = false;
+	}
+
+	if (!CheckThroughputCases())
+	{
+		printf("The bitbuf classes disagree on the throughput cases\n");
+		ok = false;
+	}
+
+	for (int startBit : { 0, 8, 3, 29 })
+	{
+		if (!CheckWriter<CBitWrite64>(startBit, 16, false) || !CheckWriter<CBitWrite64>(startBit, 200, true))
+		{
+			printf("CBitWrite64 differs from bf_write at bit offset %d\n", startBit);
+			ok = false;
+		}
+	}
+
+	if (!ok)
+		return EXIT_FAILURE;
+
+	if (g_Csv)
+		printf("compare,case,before_ns,after_ns,speedup\n");
+	else
+		printf("%-28s %12s %12s %8s\n", "case", "before ns", "after ns", "speedup");
+
+	for (int startBit : { 0, 3 })
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "info reply offset %d", startBit);
+		PrintRow(name, Measure(startBit, WriteGeneric), Measure(startBit, WriteFast<bf_write>));
+	}
+
+	for (int startBit : { 0, 3 })
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "reserved reply offset %d", startBit);
+		PrintRow(name, Measure(startBit, [](bf_write& buf) { WriteFast(buf); WriteReservedBits(buf); }), Measure(startBit, WriteReserved));
+	}
+
+	PrintRow("info schema write", Measure(0, WriteInfoFields), Measure(0, WriteInfoSchema));
+	PrintRow("info schema read", MeasureRead(ReadInfoFields), MeasureRead(ReadInfoSchema));
+
+	BenchReaders();
+	BenchWriter64();
+	BenchBatch();
+	BenchVarInts();
+	BenchStringViews();
+	BenchThroughput();
+
+	return EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 #include <steam_api.h>
 #include <isteamgamecoordinator.h>
 #include "netmessage/gcsdk_gcmessages.pb.h"
+#include "logring.hpp"
 
 using namespace std::chrono_literals;
 
@@ -160,7 +161,7 @@ inline bool GCClient::SendMessageToGC(uint32_t type, google::protobuf::Message&
 
 inline void GCClient::ProcessWelcomeMessage(char* pData, size_t length)
 {
-	printf("GC Connection established for server\n");
+	g_LogRing.Write(LogLevel::Info, "GC Connection established for server\n");
 }
 
 inline void GCClient::OnGCMessageAvailable(uint32_t msgSize)
@@ -171,7 +172,7 @@ inline void GCClient::OnGCMessageAvailable(uint32_t msgSize)
 	auto result = m_pGameCoordinator->RetrieveMessage(&msgType, memBlock.get(), msgSize, &msgSize);
 	if (result != k_EGCResultOK)
 	{
-		printf("GCMessage %d failed to retrive, error %d\n", msgType & 0xFFFF, result);
+		g_LogRing.Write(LogLevel::Warning, "GCMessage %d failed to retrive, error %d\n", static_cast<int>(msgType & 0xFFFF), static_cast<int>(result));
 		return;
 	}
 
@@ -179,14 +180,14 @@ inline void GCClient::OnGCMessageAvailable(uint32_t msgSize)
 		return;
 
 	msgType &= 0xFFFF;
-	printf("Received GC message type %d, size %d\n", msgType, msgSize);
+	g_LogRing.Write(LogLevel::Info, "Received GC message type %d, size %d\n", static_cast<int>(msgType), static_cast<int>(msgSize));
 	if (msgType == k_EMsgGCServerWelcome)
 	{
 		CMsgClientWelcome welcome;
 		welcome.ParseFromArray(memBlock.get() + sizeof(GCMsgHdr_t), msgSize - sizeof(GCMsgHdr_t));
 
 		m_ReservationCookie = welcome.cstrike15_welcome().gscookieid();
-		printf("GC Connection established for server, reservation id 0x%llX\n", m_ReservationCookie);
+		g_LogRing.Write(LogLevel::Info, "GC Connection established for server, reservation id 0x%llX\n", static_cast<unsigned long long>(m_ReservationCookie));
 	}
 
 	if (msgType == k_EMsgGCServerConnectionStatus)
@@ -0,0 +1,109 @@
+#ifndef __TINY_CSGO_SERVER_A2SCACHE_HPP__
+#define __TINY_CSGO_SERVER_A2SCACHE_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "bitbuf/bitbuf.h"
+#include "common/proto_oob.h"
+#include "packetschema.hpp"
+#include "serverinfo.hpp"
+#include "splitpacket.hpp"
+
+// Fully encoded S2A_INFO_SRC reply. Rebuilt only when the server info version or the
+// game server steam id changes, answering A2S_INFO is then a copy of ready-made bytes.
+// Every worker keeps its own copy so the hot path only compares the versions. A reply that
+// doesn't fit leaves the cache empty until the next change, the query isn't answered then.
+
+class A2sInfoCache
+{
+public:
+	bool IsValid(uint32_t infoVersion, uint64_t steamID) const
+	{
+		return m_InfoVersion == infoVersion && m_SteamID == steamID;
+	}
+
+	void Rebuild(const ServerInfo& info, uint64_t steamID, const char* gameVersion, uint16_t gamePort)
+	{
+		bf_write buf(m_Data, sizeof(m_Data));
+
+		S2aInfoSrc::Write(buf,
+			info.ServerProtocol(),
+			info.ServerName(),
+			info.ServerMap(),
+			info.ServerGameFolder(),
+			info.ServerDescription(),
+			info.ServerAppID(),
+			info.ServerNumClients(),
+			info.ServerMaxClients(),
+			info.ServerNumFakeClient(),
+			info.ServerType(),
+			info.ServerOS(),
+			info.ServerPasswordNeeded(),
+			info.ServerVacStatus(),
+			gameVersion,
+			S2A_EXTRA_DATA_HAS_GAME_PORT | S2A_EXTRA_DATA_HAS_STEAMID | S2A_EXTRA_DATA_GAMEID | S2A_EXTRA_DATA_HAS_GAMETAG_DATA,
+			gamePort,
+			steamID,
+			info.ServerTag(),
+			info.ServerAppID());
+
+		m_Length = buf.IsOverflowed() ? 0 : buf.GetNumBytesWritten();
+		m_InfoVersion = info.GetVersion();
+		m_SteamID = steamID;
+	}
+
+	const char*	GetData() const { return m_Data; }
+	size_t		GetLength() const { return m_Length; }
+
+private:
+	char		m_Data[1400];
+	size_t		m_Length = 0;
+	uint32_t	m_InfoVersion = 0;
+	uint64_t	m_SteamID = 0;
+};
+
+// S2A_PLAYER reply encoded from the mirrored player table, already cut into split packets
+// when the list doesn't fit into one datagram. Follows the player list version, and the info version for the
+// default reply which carries the max players.
+
+class A2sPlayerCache
+{
+public:
+	bool IsValid(uint32_t infoVersion, uint32_t playerVersion) const
+	{
+		return m_Packets.GetNumPackets() && m_InfoVersion == infoVersion && m_PlayerVersion == playerVersion;
+	}
+
+	void Rebuild(const ServerInfo& info)
+	{
+		bf_write buf(m_Scratch, sizeof(m_Scratch));
+
+		//A list that doesn't fit goes out as the default reply, PlayerTable keeps its lists below the limit
+		auto* pPlayers = info.GetPlayers();
+		if (!pPlayers || !S2aPlayerHeader::Write(buf) || !pPlayers->Encode(buf))
+		{
+			buf.Reset();
+			S2aPlayerDefault::Write(buf, info.ServerMaxClients(), 3600.0f);
+		}
+
+		m_InfoVersion = info.GetVersion();
+		m_PlayerVersion = info.GetA2sPlayerVersion();
+
+		//The id follows the versions so every worker numbers the same list the same way and clients
+		//never mix pieces of two different lists. The top bit would flag the pieces as compressed.
+		auto packetId = ((m_PlayerVersion << 16) ^ m_InfoVersion) & 0x7FFFFFFF;
+		m_Packets.Build(m_Scratch, buf.GetNumBytesWritten(), packetId);
+	}
+
+	const SplitPacketSet& GetPackets() const { return m_Packets; }
+
+private:
+	SplitPacketSet	m_Packets;
+	char			m_Scratch[MAX_SPLIT_REPLY_SIZE];
+	uint32_t		m_InfoVersion = 0;
+	uint32_t		m_PlayerVersion = 0;
+};
+
+#endif // !__TINY_CSGO_SERVER_A2SCACHE_HPP__
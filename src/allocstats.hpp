@@ -0,0 +1,28 @@
+#ifndef __TINY_CSGO_SERVER_ALLOCSTATS_HPP__
+#define __TINY_CSGO_SERVER_ALLOCSTATS_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Heap allocation counting, used to check that answering queries doesn't touch the heap once
+// the server is warmed up. Only built with TINY_CSGO_COUNT_ALLOCATIONS, sv-main.cpp then
+// replaces the global operator new and the server prints both counters every 10 seconds.
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef TINY_CSGO_COUNT_ALLOCATIONS
+inline std::atomic<uint64_t> g_NumAllocations = 0;
+inline std::atomic<uint64_t> g_NumPackets = 0;
+#endif
+
+//Called once for every datagram received from a client
+inline void CountPacket()
+{
+#ifdef TINY_CSGO_COUNT_ALLOCATIONS
+	g_NumPackets.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+#endif // !__TINY_CSGO_SERVER_ALLOCSTATS_HPP__
@@ -10,7 +10,6 @@
 #include "coordsize.h"
 
 #if _WIN32
-#define FAST_BIT_SCAN 1
 #if defined( _X360 )
 #define CountLeadingZeros(x) _CountLeadingZeros(x)
 inline unsigned int CountTrailingZeros( unsigned int elem )
@@ -45,9 +44,24 @@ inline unsigned int CountTrailingZeros(unsigned int elem)
 
 #endif
 #else
-#define FAST_BIT_SCAN 0
+
+inline unsigned int CountLeadingZeros(unsigned int x)
+{
+	return x ? __builtin_clz(x) : 32;
+}
+inline unsigned int CountTrailingZeros(unsigned int elem)
+{
+	return elem ? __builtin_ctz(elem) : 32;
+}
 #endif
 
+// Also fine for 32-bit targets, where there's no 64-bit bit scan
+inline unsigned int CountTrailingZeros64(uint64 elem)
+{
+	uint32 low = (uint32)elem;
+	return low ? CountTrailingZeros(low) : 32 + CountTrailingZeros((uint32)(elem >> 32));
+}
+
 
 
 static BitBufErrorHandler g_BitBufErrorHandler = 0;
@@ -803,33 +817,83 @@ void bf_write::WriteBitNormal( float f )
 //	WriteBitVec3Coord( tmp );
 //}
 
+// The byte sized writers below skip the bit packing when the cursor is byte aligned,
+// which it is for every connectionless packet. Values go out little endian either way.
 void bf_write::WriteChar(int val)
 {
+	if ( CanWriteAligned( sizeof(char) ) )
+	{
+		// Same bits as WriteSBitLong, the sign of val goes in the top bit even when val doesn't fit
+		m_pData[m_iCurBit >> 3] = (unsigned char)( ( val & 0x7F ) | ( val < 0 ? 0x80 : 0 ) );
+		m_iCurBit += sizeof(char) << 3;
+		return;
+	}
+
 	WriteSBitLong(val, sizeof(char) << 3);
 }
 
 void bf_write::WriteByte( unsigned int val )
 {
+	if ( CanWriteAligned( sizeof(unsigned char) ) )
+	{
+		m_pData[m_iCurBit >> 3] = (unsigned char)val;
+		m_iCurBit += sizeof(unsigned char) << 3;
+		return;
+	}
+
 	WriteUBitLong(val, sizeof(unsigned char) << 3);
 }
 
 void bf_write::WriteShort(int val)
 {
+	if ( CanWriteAligned( sizeof(short) ) )
+	{
+		uint16 littleVal = LittleWord( (uint16)( ( val & 0x7FFF ) | ( val < 0 ? 0x8000 : 0 ) ) );
+		memcpy( m_pData + (m_iCurBit >> 3), &littleVal, sizeof(littleVal) );
+		m_iCurBit += sizeof(short) << 3;
+		return;
+	}
+
 	WriteSBitLong(val, sizeof(short) << 3);
 }
 
 void bf_write::WriteWord( unsigned int val )
 {
+	if ( CanWriteAligned( sizeof(unsigned short) ) )
+	{
+		uint16 littleVal = LittleWord( (uint16)val );
+		memcpy( m_pData + (m_iCurBit >> 3), &littleVal, sizeof(littleVal) );
+		m_iCurBit += sizeof(unsigned short) << 3;
+		return;
+	}
+
 	WriteUBitLong(val, sizeof(unsigned short) << 3);
 }
 
 void bf_write::WriteLong(int32 val)
 {
+	if ( CanWriteAligned( sizeof(int32) ) )
+	{
+		uint32 littleVal = LittleDWord( (uint32)val );
+		memcpy( m_pData + (m_iCurBit >> 3), &littleVal, sizeof(littleVal) );
+		m_iCurBit += sizeof(int32) << 3;
+		return;
+	}
+
 	WriteSBitLong(val, sizeof(int32) << 3);
 }
 
 void bf_write::WriteLongLong(int64 val)
 {
+	// Network endian below puts the low DWORD first, so the whole thing is just little endian
+	if ( CanWriteAligned( sizeof(int64) ) )
+	{
+		uint64 littleVal = LittleQWord( (uint64)val );
+		memcpy( m_pData + (m_iCurBit >> 3), &littleVal, sizeof(littleVal) );
+		m_iCurBit += sizeof(int64) << 3;
+		return;
+	}
+
 	uint *pLongs = (uint*)&val;
 
 	// Insert the two DWORDS according to network endian
@@ -844,11 +908,25 @@ void bf_write::WriteFloat(float val)
 	// Pre-swap the float, since WriteBits writes raw data
 	LittleFloat( &val, &val );
 
+	if ( CanWriteAligned( sizeof(val) ) )
+	{
+		memcpy( m_pData + (m_iCurBit >> 3), &val, sizeof(val) );
+		m_iCurBit += sizeof(val) << 3;
+		return;
+	}
+
 	WriteBits(&val, sizeof(val) << 3);
 }
 
 bool bf_write::WriteBytes( const void *pBuf, int nBytes )
 {
+	if ( CanWriteAligned( nBytes ) )
+	{
+		memcpy( m_pData + (m_iCurBit >> 3), pBuf, nBytes );
+		m_iCurBit += nBytes << 3;
+		return !IsOverflowed();
+	}
+
 	return WriteBits(pBuf, nBytes << 3);
 }
 
@@ -856,6 +934,16 @@ bool bf_write::WriteString(const char *pStr)
 {
 	if(pStr)
 	{
+		// One copy including the terminator. Strings that don't fit take the slow path
+		// so an overflow leaves the buffer exactly as it always has.
+		int nBytes = (int)strlen( pStr ) + 1;
+		if ( CanWriteAligned( nBytes ) )
+		{
+			memcpy( m_pData + (m_iCurBit >> 3), pStr, nBytes );
+			m_iCurBit += nBytes << 3;
+			return !IsOverflowed();
+		}
+
 		do
 		{
 			WriteChar( *pStr );
@@ -984,6 +1072,30 @@ void old_bf_read::ReadBits(void *pOutData, int nBits)
 	unsigned char *pOut = (unsigned char*)pOutData;
 	int nBitsLeft = nBits;
 
+	// When all of it is in the buffer copy whole bytes, or 7 bytes per 64 bit load
+	// when the input isn't byte aligned, instead of one ReadUBitLong per dword
+	if ( m_iCurBit + nBits <= m_nDataBits )
+	{
+		if ( (m_iCurBit & 7) == 0 )
+		{
+			int nBytes = nBitsLeft >> 3;
+			memcpy( pOut, m_pData + (m_iCurBit >> 3), nBytes );
+			pOut += nBytes;
+			m_iCurBit += nBytes << 3;
+			nBitsLeft -= nBytes << 3;
+		}
+		else
+		{
+			while ( nBitsLeft >= 56 )
+			{
+				uint64 window = LittleQWord( PeekBitWindow() );
+				memcpy( pOut, &window, 7 );
+				pOut += 7;
+				m_iCurBit += 56;
+				nBitsLeft -= 56;
+			}
+		}
+	}
 	
 	// align output to dword boundary
 	while( ((uintp)pOut & 3) != 0 && nBitsLeft >= 8 )
@@ -1035,34 +1147,40 @@ float old_bf_read::ReadBitAngle( int numbits )
 	return fReturn;
 }
 
-unsigned int old_bf_read::PeekUBitLong( int numbits )
+// The next 64 bits from the current position in one load, at least 57 of them are real.
+// Bits past the end read as zero and the buffer itself is never read past its end.
+inline uint64 old_bf_read::PeekBitWindow() const
 {
-	unsigned int r;
-	int i, nBitValue;
-#ifdef BIT_VERBOSE
-	int nShifts = numbits;
-#endif
+	int iByte = m_iCurBit >> 3;
+	int nBytes = m_nDataBytes - iByte;
+	uint64 window = 0;
 
-	old_bf_read savebf;
+	if ( nBytes >= (int)sizeof(window) )
+	{
+		memcpy( &window, m_pData + iByte, sizeof(window) );
+		window = LittleQWord( window );
+	}
+	else
+	{
+		for ( int i = 0; i < nBytes; ++i )
+			window |= (uint64)m_pData[iByte + i] << (i << 3);
+	}
 
-	savebf = *this;  // Save current state info
+	window >>= (m_iCurBit & 7);
 
-	r = 0;
-	for(i=0; i < numbits; i++)
-	{
-		nBitValue = ReadOneBit();
+	int nBitsLeft = m_nDataBits - m_iCurBit;
+	if ( nBitsLeft < 64 )
+		window &= ((uint64)1 << (nBitsLeft > 0 ? nBitsLeft : 0)) - 1;
 
-		// Append to current stream
-		if ( nBitValue )
-		{
-			r |= BitForBitnum(i);
-		}
-	}
-	
-	*this = savebf;
+	return window;
+}
+
+unsigned int old_bf_read::PeekUBitLong( int numbits )
+{
+	unsigned int r = (unsigned int)( PeekBitWindow() & (((uint64)1 << numbits) - 1) );
 
 #ifdef BIT_VERBOSE
-	Con_Printf( "PeekBitLong:  %i %i\n", nShifts, (unsigned int)r );
+	Con_Printf( "PeekBitLong:  %i %i\n", numbits, r );
 #endif
 
 	return r;
@@ -1084,49 +1202,33 @@ int old_bf_read::ReadSBitLong( int numbits )
 	return r;
 }
 
-const byte g_BitMask[8] = {0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80};
-const byte g_TrailingMask[8] = {0xff, 0xfe, 0xfc, 0xf8, 0xf0, 0xe0, 0xc0, 0x80};
 
-inline int old_bf_read::CountRunOfZeros()
+int old_bf_read::CountRunOfZeros()
 {
 	int bits = 0;
-	if ( m_iCurBit + 32 < m_nDataBits )
+	while ( true )
 	{
-#if !FAST_BIT_SCAN
-		while (true)
+		// Bits past the end are zero, so a set bit in the window is always a real one
+		uint64 window = PeekBitWindow();
+		if ( window )
 		{
-			int value = (m_pData[m_iCurBit >> 3] & g_BitMask[m_iCurBit & 7]);
-			++m_iCurBit;
-			if ( value )
-				return bits;
-			++bits;
+			int zeros = CountTrailingZeros64( window );
+			m_iCurBit += zeros + 1;
+			return bits + zeros;
 		}
-#else
-		while (true)
+
+		int nBitsLeft = GetNumBitsLeft();
+		if ( nBitsLeft <= 56 )
 		{
-			int value = (m_pData[m_iCurBit >> 3] & g_TrailingMask[m_iCurBit & 7]);
-			if ( !value )
-			{
-				int zeros = (8-(m_iCurBit&7));
-				bits += zeros;
-				m_iCurBit += zeros;
-			}
-			else
-			{
-				int zeros = CountTrailingZeros(value) - (m_iCurBit & 7);
-				m_iCurBit += zeros + 1;
-				bits += zeros;
-				return bits;
-			}
+			// Ran off the end without finding the set bit
+			m_iCurBit = m_nDataBits;
+			SetOverflowFlag();
+			return bits + nBitsLeft;
 		}
-#endif
-	}
-	else
-	{
-		while ( ReadOneBit() == 0 )
-			bits++;
+
+		bits += 56;
+		m_iCurBit += 56;
 	}
-	return bits;
 }
 
 unsigned int old_bf_read::ReadUBitVar()
@@ -1165,6 +1267,43 @@ unsigned int old_bf_read::ReadUBitVar()
 // 40-bits: 268435456-0xFFFFFFFF
 uint32 old_bf_read::ReadVarInt32()
 {
+	// Fast path while a whole 64-bit load fits in the buffer. One and two byte varints are
+	// picked off first, the mask decode's dependency chain costs more than those branches.
+	int iByte = m_iCurBit >> 3;
+	if ( iByte + (int)sizeof(uint64) <= m_nDataBytes )
+	{
+		uint64 window;
+		memcpy( &window, m_pData + iByte, sizeof(window) );
+		window = LittleQWord( window ) >> ( m_iCurBit & 7 );
+
+		int nBytes;
+		uint32 nWindowResult;
+		if ( !( window & 0x80 ) )
+		{
+			nBytes = 1;
+			nWindowResult = (uint32)( window & 0x7F );
+		}
+		else if ( !( window & 0x8000 ) )
+		{
+			nBytes = 2;
+			nWindowResult = (uint32)( ( window & 0x7F ) | ( ( window >> 1 ) & 0x3F80 ) );
+		}
+		else
+		{
+			uint64 nDecoded;
+			bool bComplete;
+			nBytes = bitbuf::DecodeVarintWindow( window, bitbuf::kMaxVarint32Bytes, nDecoded, bComplete );
+			nWindowResult = (uint32)nDecoded;
+		}
+
+		// The window may run into the unused bits of a partial last byte
+		if ( m_iCurBit + ( nBytes << 3 ) <= m_nDataBits )
+		{
+			m_iCurBit += nBytes << 3;
+			return nWindowResult;
+		}
+	}
+
 	uint32 result = 0;
 	int count = 0;
 	uint32 b;
@@ -1192,6 +1331,23 @@ uint64 old_bf_read::ReadVarInt64()
 	int count = 0;
 	uint64 b;
 
+	// Fast path for the bytes in the window, 8 when aligned and 7 when not. A longer
+	// varint carries on a byte at a time below.
+	bool bComplete;
+	int nBytes = bitbuf::DecodeVarintWindow( PeekBitWindow(), ( 64 - ( m_iCurBit & 7 ) ) >> 3, result, bComplete );
+	if ( m_iCurBit + ( nBytes << 3 ) <= m_nDataBits )
+	{
+		m_iCurBit += nBytes << 3;
+		if ( bComplete )
+			return result;
+
+		count = nBytes;
+	}
+	else
+	{
+		result = 0;
+	}
+
 	do 
 	{
 		if ( count == bitbuf::kMaxVarintBytes ) 
@@ -1206,6 +1362,12 @@ uint64 old_bf_read::ReadVarInt64()
 	return result;
 }
 
+void old_bf_read::ReadVarInt32Array( uint32 *pOut, int nCount )
+{
+	for ( int i = 0; i < nCount; ++i )
+		pOut[i] = ReadVarInt32();
+}
+
 unsigned int old_bf_read::ReadBitLong(int numbits, bool bSigned)
 {
 	if(bSigned)
@@ -1524,6 +1686,44 @@ bool old_bf_read::ReadString( char *pStr, int maxLen, bool bLine, int *pOutNumCh
 	return !IsOverflowed() && !bTooSmall;
 }
 
+bool old_bf_read::ReadStringView( std::string_view &str )
+{
+	if ( m_iCurBit & 7 )
+		return false;
+
+	// memchr finds the terminator a vector at a time instead of a ReadChar per character
+	const char *pStart = reinterpret_cast<const char *>( m_pData ) + ( m_iCurBit >> 3 );
+	int nBytesLeft = GetNumBytesLeft();
+	const char *pEnd = nBytesLeft > 0 ? static_cast<const char *>( memchr( pStart, 0, nBytesLeft ) ) : NULL;
+	if ( !pEnd )
+	{
+		m_iCurBit = m_nDataBits;
+		SetOverflowFlag();
+		return false;
+	}
+
+	str = std::string_view( pStart, pEnd - pStart );
+	m_iCurBit += (int)( pEnd - pStart + 1 ) << 3;
+	return true;
+}
+
+bool old_bf_read::ReadBytesView( std::string_view &bytes, int nBytes )
+{
+	if ( m_iCurBit & 7 )
+		return false;
+
+	if ( nBytes > GetNumBytesLeft() )
+	{
+		m_iCurBit = m_nDataBits;
+		SetOverflowFlag();
+		return false;
+	}
+
+	bytes = std::string_view( reinterpret_cast<const char *>( m_pData ) + ( m_iCurBit >> 3 ), nBytes );
+	m_iCurBit += nBytes << 3;
+	return true;
+}
+
 bool old_bf_read::ReadWString( wchar_t *pStr, int maxLen, bool bLine, int *pOutNumChars )
 {
 	//Assert( maxLen != 0 );
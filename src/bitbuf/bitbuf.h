@@ -15,6 +15,10 @@
 #pragma once
 #endif
 
+#include <assert.h>
+#include <string.h>
+#include <bit>
+#include <string_view>
 #include "platform.h"
 
 #ifdef _WIN32
@@ -131,12 +135,55 @@ namespace bitbuf
 
 	const int kMaxVarintBytes = 10;
 	const int kMaxVarint32Bytes = 5;
+
+	// Decodes the varint at the bottom of a little endian window of bytes, reading at most
+	// nMaxBytes (1..8) of them. Returns how many bytes it used and sets bComplete if the
+	// last of them ended the varint. Finds the end with a mask instead of a loop.
+	inline int DecodeVarintWindow( uint64 nWindow, int nMaxBytes, uint64 &nResult, bool &bComplete )
+	{
+		uint64 nLastStop = (uint64)0x80 << ( ( nMaxBytes - 1 ) << 3 );
+		uint64 nStops = ~nWindow & 0x8080808080808080ull & ( nLastStop | ( nLastStop - 1 ) );
+		bComplete = nStops != 0;
+
+		// Without a real stop the varint ends at the limit
+		nStops |= nLastStop;
+
+		// Every bit up to and including the first stop bit
+		uint64 nUsed = nStops ^ ( nStops - 1 );
+
+		// Squeeze the 7 bit groups together, pairs first, then quads, then both halves
+		uint64 x = nWindow & nUsed & 0x7F7F7F7F7F7F7F7Full;
+		x = ( ( x & 0x7F007F007F007F00ull ) >> 1 ) | ( x & 0x007F007F007F007Full );
+		x = ( ( x & 0x3FFF00003FFF0000ull ) >> 2 ) | ( x & 0x00003FFF00003FFFull );
+		x = ( ( x & 0x0FFFFFFF00000000ull ) >> 4 ) | ( x & 0x000000000FFFFFFFull );
+		nResult = x;
+
+#if defined( __GNUC__ )
+		return ( __builtin_ctzll( nStops ) + 1 ) >> 3;
+#else
+		// One bit 7 per used byte, the multiply adds them up in the top byte
+		return (int)( ( ( ( nUsed >> 7 ) & 0x0101010101010101ull ) * 0x0101010101010101ull ) >> 56 );
+#endif
+	}
+
+	// The low 56 bits as 8 varint bytes of 7 bits each, continuation bits not set yet.
+	// The counterpart of the squeeze in DecodeVarintWindow.
+	inline uint64 SpreadVarintBytes( uint64 n )
+	{
+		// 28 bit halves into 32 bit lanes, 14 bit quarters into 16 bit lanes, then 7 bits into every byte
+		n = ( ( n & 0x00FFFFFFF0000000ull ) << 4 ) | ( n & 0x000000000FFFFFFFull );
+		n = ( ( n & 0x0FFFC0000FFFC000ull ) << 2 ) | ( n & 0x00003FFF00003FFFull );
+		n = ( ( n & 0x3F803F803F803F80ull ) << 1 ) | ( n & 0x007F007F007F007Full );
+		return n;
+	}
 }
 
 //-----------------------------------------------------------------------------
 // Used for serialization
 //-----------------------------------------------------------------------------
 
+class bf_write_reserved;
+
 class bf_write
 {
 public:
@@ -182,6 +229,7 @@ public:
 	
 	// Write signed or unsigned. Range is only checked in debug.
 	void			WriteUBitLong( unsigned int data, int numbits, bool bCheckRange=true );
+	void			WriteUBitLongNoCheck( unsigned int data, int numbits );
 	void			WriteSBitLong( int data, int numbits );
 	
 	// Tell it whether or not the data is unsigned. If it's signed,
@@ -212,6 +260,11 @@ public:
 	void			WriteBitCoord (const float f);
 	void			WriteBitCoordMP( const float f, EBitCoordType coordType );
 	void 			WriteBitCellCoord( const float f, int bits, EBitCoordType coordType );
+
+	// Quantize and write nCount values a block at a time, the same bits as the writers above in a loop
+	void			WriteBitCoordMPArray( const float *pValues, int nCount, EBitCoordType coordType );
+	void			WriteBitCellCoordArray( const float *pValues, int nCount, int bits, EBitCoordType coordType );
+	void			WriteBitNormalArray( const float *pValues, int nCount );
 	void			WriteBitFloat(float val);
 	void			WriteBitNormal( float f );
 
@@ -232,6 +285,14 @@ public:
 	bool			WriteString(const wchar_t *pStr);
 
 
+// Reserved writes.
+public:
+
+	// Checks once that nBits fit and returns a writer that skips the check for each field
+	// inside them. If they don't fit this buffer overflows and the writer is invalid.
+	bf_write_reserved	Reserve( int nBits );
+
+
 // Status.
 public:
 
@@ -261,6 +322,9 @@ public:
 	
 private:
 
+	// Is the cursor on a byte boundary with room for nBytes? Then a write is a plain copy.
+	inline bool		CanWriteAligned(int nBytes) const;
+
 	// Errors?
 	bool			m_bOverflow;
 
@@ -320,6 +384,11 @@ inline bool bf_write::CheckForOverflow(int nBits)
 	return m_bOverflow;
 }
 
+inline bool bf_write::CanWriteAligned(int nBytes) const
+{
+	return (m_iCurBit & 7) == 0 && nBytes >= 0 && nBytes <= (m_nDataBits - m_iCurBit) >> 3;
+}
+
 inline void bf_write::SetOverflowFlag()
 {
 	if ( m_bAssertOnOverflow )
@@ -377,8 +446,6 @@ inline void bf_write::WriteUBitLong( unsigned int curData, int numbits, bool bCh
 	//Assert( numbits >= 0 && numbits <= 32 );
 #endif
 
-	extern uint32 g_BitWriteMasks[32][33];
-
 	// Bounds checking..
 	if ((m_iCurBit+numbits) > m_nDataBits)
 	{
@@ -388,6 +455,13 @@ inline void bf_write::WriteUBitLong( unsigned int curData, int numbits, bool bCh
 		return;
 	}
 
+	WriteUBitLongNoCheck( curData, numbits );
+}
+
+inline void bf_write::WriteUBitLongNoCheck( unsigned int curData, int numbits )
+{
+	extern uint32 g_BitWriteMasks[32][33];
+
 	int nBitsLeft = numbits;
 	int iCurBit = m_iCurBit;
 
@@ -440,6 +514,188 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Writes into a span bf_write::Reserve already checked, for layouts whose size
+// is known before the first field goes in. Writes the same bits as the bf_write
+// functions with the same names. Debug builds assert the span isn't overrun.
+//-----------------------------------------------------------------------------
+
+class bf_write_reserved
+{
+public:
+	bf_write_reserved() : m_pBuf( NULL ), m_iEndBit( 0 ) {}
+	bf_write_reserved( bf_write *pBuf, int nBits ) : m_pBuf( pBuf ), m_iEndBit( pBuf->m_iCurBit + nBits ) {}
+
+	// False if the reservation didn't fit, nothing may be written then.
+	bool			IsValid() const { return m_pBuf != NULL; }
+	explicit		operator bool() const { return IsValid(); }
+
+	int				GetNumBitsLeft() const { return m_iEndBit - m_pBuf->m_iCurBit; }
+
+	void			WriteOneBit( int nValue );
+	void			WriteUBitLong( unsigned int data, int numbits );
+	void			WriteSBitLong( int data, int numbits );
+	void			WriteVarInt32( uint32 data );
+	void			WriteVarInt64( uint64 data );
+
+	void			WriteChar( int val ) { WriteByte( ( val & 0x7F ) | ( val < 0 ? 0x80 : 0 ) ); }
+	void			WriteByte( unsigned int val );
+	void			WriteShort( int val ) { WriteWord( ( val & 0x7FFF ) | ( val < 0 ? 0x8000 : 0 ) ); }
+	void			WriteWord( unsigned int val );
+	void			WriteLong( int32 val );
+	void			WriteLongLong( int64 val );
+	void			WriteFloat( float val );
+	void			WriteBytes( const void *pBuf, int nBytes );
+	void			WriteString( const char *pStr );
+
+private:
+
+	// Only checked in debug, the whole span was checked by Reserve.
+	void			Use( int nBits ) const
+	{
+		assert( m_pBuf && m_pBuf->m_iCurBit + nBits <= m_iEndBit );
+		(void)nBits;
+	}
+
+	// On a byte boundary whole bytes are plain stores.
+	bool			IsAligned() const { return ( m_pBuf->m_iCurBit & 7 ) == 0; }
+	void			StoreAligned( const void *pData, int nBytes );
+
+	bf_write		*m_pBuf;
+	int				m_iEndBit;
+};
+
+inline bf_write_reserved bf_write::Reserve( int nBits )
+{
+	if ( nBits < 0 || CheckForOverflow( nBits ) )
+		return bf_write_reserved();
+
+	return bf_write_reserved( this, nBits );
+}
+
+inline void bf_write_reserved::StoreAligned( const void *pData, int nBytes )
+{
+	memcpy( m_pBuf->m_pData + ( m_pBuf->m_iCurBit >> 3 ), pData, nBytes );
+	m_pBuf->m_iCurBit += nBytes << 3;
+}
+
+inline void bf_write_reserved::WriteOneBit( int nValue )
+{
+	Use( 1 );
+	m_pBuf->WriteOneBitNoCheck( nValue );
+}
+
+inline void bf_write_reserved::WriteUBitLong( unsigned int data, int numbits )
+{
+	Use( numbits );
+	m_pBuf->WriteUBitLongNoCheck( data, numbits );
+}
+
+inline void bf_write_reserved::WriteSBitLong( int data, int numbits )
+{
+	// The low numbits-1 bits, then the sign, like bf_write::WriteSBitLong
+	uint32 nSignBit = 1u << ( numbits - 1 );
+	uint32 nBits = ( (uint32)data & ( nSignBit - 1 ) ) | ( data < 0 ? nSignBit : 0 );
+	WriteUBitLong( nBits, numbits );
+}
+
+inline void bf_write_reserved::WriteVarInt32( uint32 data )
+{
+	while ( data > 0x7F )
+	{
+		WriteByte( ( data & 0x7F ) | 0x80 );
+		data >>= 7;
+	}
+	WriteByte( data );
+}
+
+inline void bf_write_reserved::WriteVarInt64( uint64 data )
+{
+	while ( data > 0x7F )
+	{
+		WriteByte( (uint32)( data & 0x7F ) | 0x80 );
+		data >>= 7;
+	}
+	WriteByte( (uint32)data );
+}
+
+inline void bf_write_reserved::WriteByte( unsigned int val )
+{
+	Use( 8 );
+	if ( IsAligned() )
+	{
+		m_pBuf->m_pData[m_pBuf->m_iCurBit >> 3] = (unsigned char)val;
+		m_pBuf->m_iCurBit += 8;
+	}
+	else
+		m_pBuf->WriteUBitLongNoCheck( val & 0xFF, 8 );
+}
+
+inline void bf_write_reserved::WriteWord( unsigned int val )
+{
+	Use( 16 );
+	if ( IsAligned() )
+	{
+		uint16 nLittle = LittleWord( (uint16)val );
+		StoreAligned( &nLittle, sizeof( nLittle ) );
+	}
+	else
+		m_pBuf->WriteUBitLongNoCheck( val & 0xFFFF, 16 );
+}
+
+inline void bf_write_reserved::WriteLong( int32 val )
+{
+	Use( 32 );
+	if ( IsAligned() )
+	{
+		uint32 nLittle = LittleDWord( (uint32)val );
+		StoreAligned( &nLittle, sizeof( nLittle ) );
+	}
+	else
+		m_pBuf->WriteUBitLongNoCheck( (uint32)val, 32 );
+}
+
+inline void bf_write_reserved::WriteLongLong( int64 val )
+{
+	// Low dword first, like bf_write::WriteLongLong
+	WriteLong( (int32)( (uint64)val & 0xFFFFFFFF ) );
+	WriteLong( (int32)( (uint64)val >> 32 ) );
+}
+
+inline void bf_write_reserved::WriteFloat( float val )
+{
+	uint32 nBits;
+	memcpy( &nBits, &val, sizeof( nBits ) );
+	WriteLong( (int32)nBits );
+}
+
+inline void bf_write_reserved::WriteBytes( const void *pBuf, int nBytes )
+{
+	Use( nBytes << 3 );
+	if ( IsAligned() )
+	{
+		StoreAligned( pBuf, nBytes );
+		return;
+	}
+
+	const unsigned char *pIn = (const unsigned char *)pBuf;
+	for ( ; nBytes >= 4; nBytes -= 4, pIn += 4 )
+	{
+		uint32 nDWord;
+		memcpy( &nDWord, pIn, sizeof( nDWord ) );
+		m_pBuf->WriteUBitLongNoCheck( LittleDWord( nDWord ), 32 );
+	}
+	for ( ; nBytes > 0; --nBytes )
+		m_pBuf->WriteUBitLongNoCheck( *pIn++, 8 );
+}
+
+inline void bf_write_reserved::WriteString( const char *pStr )
+{
+	// The terminator goes in too
+	WriteBytes( pStr, (int)strlen( pStr ) + 1 );
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Used for unserialization
@@ -508,12 +764,16 @@ public:
 	unsigned int	PeekUBitLong( int numbits );
 	int				ReadSBitLong( int numbits );
 
+	// Number of zero bits up to the next set bit, which is read as well.
+	int				CountRunOfZeros();
+
 	// reads an unsigned integer with variable bit length
 	unsigned int	ReadUBitVar();
 	
 	// reads a varint encoded integer
 	uint32			ReadVarInt32();
 	uint64			ReadVarInt64();
+	void			ReadVarInt32Array( uint32 *pOut, int nCount );
 	int32			ReadSignedVarInt32();
 	int64			ReadSignedVarInt64();
 
@@ -556,6 +816,12 @@ public:
 	bool			ReadString( char *pStr, int bufLen, bool bLine=false, int *pOutNumChars=NULL );
 	bool			ReadWString( wchar_t *pStr, int bufLen, bool bLine=false, int *pOutNumChars=NULL );
 
+	// Like ReadString and ReadBytes, but str and bytes point into the buffer instead of getting
+	// a copy, so they are only valid as long as the buffer is. Only works byte aligned, otherwise
+	// they return false and don't move. Running past the end overflows.
+	bool			ReadStringView( std::string_view &str );
+	bool			ReadBytesView( std::string_view &bytes, int nBytes );
+
 	// Reads a string and allocates memory for it. If the string in the buffer
 	// is > 2048 bytes, then pOverflow is set to true (if it's not NULL).
 	char*			ReadAndAllocateString( bool *pOverflow = 0 );
@@ -589,8 +855,8 @@ public:
 
 
 private:	
-	// used by varbit reads internally
-	inline int CountRunOfZeros();
+	// 64 bits from the current position in one load, used by the word-wise readers
+	inline uint64	PeekBitWindow() const;
 
 	// Errors?
 	bool			m_bOverflow;
@@ -868,6 +1134,8 @@ public:
 	FORCEINLINE void WriteUBitLong( unsigned int data, int numbits, bool bCheckRange=true );
 	FORCEINLINE void WriteSBitLong( int data, int numbits );
 	FORCEINLINE void WriteUBitVar( unsigned int data );
+	void WriteVarInt32( uint32 data );
+	void WriteVarInt64( uint64 data );
 	FORCEINLINE void WriteBitFloat( float flValue );
 	FORCEINLINE void WriteFloat( float flValue );
 	bool WriteBits(const void *pInData, int nBits);
@@ -976,7 +1244,8 @@ void CBitWrite::WriteOneBitNoCheck( int nValue )
 
 void CBitWrite::WriteOneBit( int nValue )
 {
-	m_nOutBufWord |= ( nValue & 1 ) << ( 32 - m_nOutBitsAvail );
+	// Any non-zero value is a set bit, like bf_write. The coord writers pass the integer part here
+	m_nOutBufWord |= ( nValue ? 1u : 0u ) << ( 32 - m_nOutBitsAvail );
 	if ( --m_nOutBitsAvail == 0 )
 	{
 		Flush();
@@ -1051,6 +1320,260 @@ FORCEINLINE void CBitWrite::WriteFloat( float flValue )
 	WriteUBitLong( *((uint32 *) &flValue ), 32 );
 }
 
+//-----------------------------------------------------------------------------
+// Bit writer with a 64 bit accumulator. Fields are packed into a register and only whole
+// 64 bit words go to memory, so most writes are a shift and an or. The output is bit for
+// bit what bf_write writes, Finish() has to be called before the data is used.
+//-----------------------------------------------------------------------------
+
+class CBitWrite64 : public CBitBuffer
+{
+	uint64 m_nOutBufWord;
+	int m_nOutBitsUsed;
+	uint8 *m_pDataOut;										// where the next word goes, any byte
+	uint8 *m_pDataEnd;										// end of the last whole byte that fits
+	uint8 *m_pData;
+
+public:
+	CBitWrite64( void *pData, int nBytes, int nBits = -1 )
+	{
+		StartWriting( pData, nBytes, nBits );
+	}
+
+	CBitWrite64( const char *pDebugName, void *pData, int nBytes, int nBits = -1 )
+	{
+		SetDebugName( pDebugName );
+		StartWriting( pData, nBytes, nBits );
+	}
+
+	void StartWriting( void *pData, int nBytes, int nBits = -1 );
+
+	FORCEINLINE void Reset( void )
+	{
+		m_bOverflow = false;
+		m_nOutBufWord = 0;
+		m_nOutBitsUsed = 0;
+		m_pDataOut = m_pData;
+	}
+
+	FORCEINLINE int GetNumBitsWritten( void ) const
+	{
+		return int( m_pDataOut - m_pData ) * 8 + m_nOutBitsUsed;
+	}
+
+	FORCEINLINE int GetNumBytesWritten( void ) const
+	{
+		return ( GetNumBitsWritten() + 7 ) >> 3;
+	}
+
+	FORCEINLINE int GetNumBitsLeft( void ) const
+	{
+		return m_nDataBits - GetNumBitsWritten();
+	}
+
+	// Stores the bytes of the partial word, can be called any number of times
+	FORCEINLINE void Finish( void );
+
+	FORCEINLINE unsigned char *GetData( void )
+	{
+		Finish();
+		return m_pData;
+	}
+
+	// Up to 64 bits, value must not have bits set above nNumBits
+	FORCEINLINE void WriteUBit64( uint64 nValue, int nNumBits );
+
+	FORCEINLINE void WriteOneBit( int nValue )
+	{
+		WriteUBit64( nValue ? 1 : 0, 1 );
+	}
+
+	FORCEINLINE void WriteUBitLong( unsigned int nData, int nNumBits )
+	{
+		WriteUBit64( nData & s_nMaskTable[nNumBits], nNumBits );
+	}
+
+	// Same encoding as bf_write, the low bits with the sign as the top bit
+	FORCEINLINE void WriteSBitLong( int nData, int nNumBits )
+	{
+		uint32 nSign = nData < 0 ? 1u << ( nNumBits - 1 ) : 0;
+		WriteUBit64( ( nData & s_nMaskTable[nNumBits - 1] ) | nSign, nNumBits );
+	}
+
+	FORCEINLINE void WriteUBitVar( unsigned int n );
+	FORCEINLINE void WriteVarInt32( uint32 nData );
+	FORCEINLINE void WriteVarInt64( uint64 nData );
+
+	void WriteBitCoord( const float f );
+	void WriteBitCoordMP( const float f, EBitCoordType coordType );
+	void WriteBitCellCoord( const float f, int bits, EBitCoordType coordType );
+	void WriteBitNormal( float f );
+
+	// Quantize and write nCount values a block at a time, the same bits as the writers above in a loop
+	void WriteBitCoordMPArray( const float *pValues, int nCount, EBitCoordType coordType );
+	void WriteBitCellCoordArray( const float *pValues, int nCount, int bits, EBitCoordType coordType );
+	void WriteBitNormalArray( const float *pValues, int nCount );
+
+	FORCEINLINE void WriteBitFloat( float flValue )
+	{
+		uint32 nBits;
+		memcpy( &nBits, &flValue, sizeof(nBits) );
+		WriteUBit64( nBits, 32 );
+	}
+
+	FORCEINLINE void WriteChar( int val ) { WriteSBitLong( val, sizeof(char) << 3 ); }
+	FORCEINLINE void WriteByte( unsigned int val ) { WriteUBitLong( val, sizeof(unsigned char) << 3 ); }
+	FORCEINLINE void WriteShort( int val ) { WriteSBitLong( val, sizeof(short) << 3 ); }
+	FORCEINLINE void WriteWord( unsigned int val ) { WriteUBitLong( val, sizeof(unsigned short) << 3 ); }
+	FORCEINLINE void WriteLong( int32 val ) { WriteUBit64( (uint32)val, sizeof(int32) << 3 ); }
+	FORCEINLINE void WriteLongLong( int64 val ) { WriteUBit64( (uint64)val, sizeof(int64) << 3 ); }
+	FORCEINLINE void WriteFloat( float val ) { WriteBitFloat( val ); }
+
+	FORCEINLINE void WriteBytes( const void *pBuf, int nBytes );
+	FORCEINLINE bool WriteString( const char *pStr );
+
+private:
+	FORCEINLINE void Flush( void )
+	{
+		if ( m_pDataEnd - m_pDataOut < (int)sizeof(uint64) )
+		{
+			SetOverflowFlag();
+			CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, m_pDebugName );
+			return;
+		}
+
+		uint64 nWord = LittleQWord( m_nOutBufWord );
+		memcpy( m_pDataOut, &nWord, sizeof(nWord) );
+		m_pDataOut += sizeof(nWord);
+	}
+};
+
+FORCEINLINE void CBitWrite64::WriteUBit64( uint64 nValue, int nNumBits )
+{
+	m_nOutBufWord |= nValue << m_nOutBitsUsed;
+
+	int nBitsUsed = m_nOutBitsUsed + nNumBits;
+	if ( nBitsUsed < 64 )
+	{
+		m_nOutBitsUsed = nBitsUsed;
+		return;
+	}
+
+	// The word is full, what didn't fit starts the next one
+	Flush();
+	m_nOutBitsUsed = nBitsUsed - 64;
+	m_nOutBufWord = m_nOutBitsUsed ? nValue >> ( nNumBits - m_nOutBitsUsed ) : 0;
+}
+
+FORCEINLINE void CBitWrite64::WriteUBitVar( unsigned int n )
+{
+	if ( n < 16 )
+		WriteUBit64( n, 6 );
+	else if ( n < 256 )
+		WriteUBit64( ( n & 15 ) | 16 | ( ( n & ( 128 | 64 | 32 | 16 ) ) << 2 ), 10 );
+	else if ( n < 4096 )
+		WriteUBit64( ( n & 15 ) | 32 | ( ( n & ( 2048 | 1024 | 512 | 256 | 128 | 64 | 32 | 16 ) ) << 2 ), 14 );
+	else
+		WriteUBit64( ( n & 15 ) | 48 | ( (uint64)( n >> 4 ) << 6 ), 6 + 32 - 4 );
+}
+
+// All bytes of the varint go in with one write
+FORCEINLINE void CBitWrite64::WriteVarInt32( uint32 nData )
+{
+	uint64 nEncoded = 0;
+	int nNumBits = 0;
+	while ( nData > 0x7F )
+	{
+		nEncoded |= (uint64)( ( nData & 0x7F ) | 0x80 ) << nNumBits;
+		nData >>= 7;
+		nNumBits += 8;
+	}
+
+	WriteUBit64( nEncoded | ( (uint64)nData << nNumBits ), nNumBits + 8 );
+}
+
+FORCEINLINE void CBitWrite64::Finish( void )
+{
+	if ( !m_nOutBitsUsed || m_bOverflow )
+		return;
+
+	if ( GetNumBitsWritten() > m_nDataBits )
+	{
+		SetOverflowFlag();
+		CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, m_pDebugName );
+		return;
+	}
+
+	uint64 nWord = LittleQWord( m_nOutBufWord );
+	memcpy( m_pDataOut, &nWord, ( m_nOutBitsUsed + 7 ) >> 3 );
+}
+
+// The bytes are put together without a loop over them, so the time doesn't depend on the
+// value. Up to 56 bits that's one write, a longer one takes a second write for the last
+// one or two bytes.
+FORCEINLINE void CBitWrite64::WriteVarInt64( uint64 nData )
+{
+	const uint64 nContinue = 0x8080808080808080ull;
+	if ( nData < ( (uint64)1 << 56 ) )
+	{
+		int nBytes = ( std::bit_width( nData | 1 ) + 6 ) / 7;
+		WriteUBit64( bitbuf::SpreadVarintBytes( nData ) | ( ( nContinue >> ( 64 - ( nBytes << 3 ) ) ) >> 8 ), nBytes << 3 );
+		return;
+	}
+
+	WriteUBit64( bitbuf::SpreadVarintBytes( nData ) | nContinue, 64 );
+	nData >>= 56;
+	if ( nData > 0x7F )
+		WriteUBit64( ( nData & 0x7F ) | 0x80 | ( ( nData >> 7 ) << 8 ), 16 );
+	else
+		WriteUBit64( nData, 8 );
+}
+
+FORCEINLINE void CBitWrite64::WriteBytes( const void *pBuf, int nBytes )
+{
+	const uint8 *pIn = (const uint8 *) pBuf;
+
+	// At a byte boundary the bytes are copied behind the pending ones. Those and the copy
+	// cover at least a word, so the whole accumulator can be stored first.
+	if ( !( m_nOutBitsUsed & 7 ) && nBytes >= (int)sizeof(uint64) && !m_bOverflow &&
+		GetNumBitsWritten() + ( nBytes << 3 ) <= m_nDataBits )
+	{
+		uint64 nWord = LittleQWord( m_nOutBufWord );
+		memcpy( m_pDataOut, &nWord, sizeof(nWord) );
+		memcpy( m_pDataOut + ( m_nOutBitsUsed >> 3 ), pIn, nBytes );
+		m_pDataOut += ( m_nOutBitsUsed >> 3 ) + nBytes;
+		m_nOutBufWord = 0;
+		m_nOutBitsUsed = 0;
+		return;
+	}
+
+	// Whole words straight into the accumulator, the stream is little endian like the words
+	for ( ; nBytes >= (int)sizeof(uint64); nBytes -= sizeof(uint64), pIn += sizeof(uint64) )
+	{
+		uint64 nWord;
+		memcpy( &nWord, pIn, sizeof(nWord) );
+		WriteUBit64( LittleQWord( nWord ), 64 );
+	}
+
+	if ( nBytes > 0 )
+	{
+		uint64 nWord = 0;
+		for ( int i = 0; i < nBytes; ++i )
+			nWord |= (uint64)pIn[i] << ( i << 3 );
+		WriteUBit64( nWord, nBytes << 3 );
+	}
+}
+
+FORCEINLINE bool CBitWrite64::WriteString( const char *pStr )
+{
+	if ( pStr )
+		WriteBytes( pStr, (int)strlen( pStr ) + 1 );
+	else
+		WriteByte( 0 );
+
+	return !IsOverflowed();
+}
+
 class CBitRead : public CBitBuffer
 {
 	uint32 m_nInBufWord;
@@ -1123,6 +1646,11 @@ public:
 	float ReadBitCoordMP( EBitCoordType coordType );
 	float ReadBitCellCoord( int bits, EBitCoordType coordType );
 	float ReadBitNormal();
+
+	// Read nCount values into pOut, the same floats as the readers above in a loop
+	void ReadBitCoordMPArray( float *pOut, int nCount, EBitCoordType coordType );
+	void ReadBitCellCoordArray( float *pOut, int nCount, int bits, EBitCoordType coordType );
+	void ReadBitNormalArray( float *pOut, int nCount );
 	bool ReadBytes(void *pOut, int nBytes);
 	float ReadBitAngle( int numbits );
 
@@ -1153,13 +1681,23 @@ public:
 	bool ReadWString( OUT_Z_CAP(maxLenInChars) wchar_t *pStr, int maxLenInChars, bool bLine=false, int *pOutNumChars=NULL );
 	char* ReadAndAllocateString( bool *pOverflow = 0 );
 
+	// Views into the buffer instead of copies, see old_bf_read::ReadStringView
+	bool ReadStringView( std::string_view &str );
+	bool ReadBytesView( std::string_view &bytes, int nBytes );
+
 	int64 ReadLongLong( void );
 
 	// reads a varint encoded integer
 	uint32			ReadVarInt32();
 	uint64			ReadVarInt64();
+	void			ReadVarInt32Array( uint32 *pOut, int nCount );
 	int32			ReadSignedVarInt32() { return bitbuf::ZigZagDecode32( ReadVarInt32() ); }
 	int64			ReadSignedVarInt64() { return bitbuf::ZigZagDecode64( ReadVarInt64() ); }
+
+private:
+	// Decodes up to nMaxBytes of a varint from the buffered word and the next 8 bytes and
+	// skips what it used. Returns 0 without reading when those bytes run past the buffer.
+	int ReadVarintWindow( int nMaxBytes, uint64 &nResult, bool &bComplete );
 };
 
 
@@ -0,0 +1,608 @@
+//========= Copyright ?1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Array versions of the coord and normal writers and readers. Values are
+//			quantized or dequantized a block at a time, with AVX2 or SSE4.1 when the
+//			cpu has them, and go on the wire one value per write. The bits and the
+//			floats are the same as calling the single value functions in a loop.
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#include "bitbuf.h"
+#include "coordsize.h"
+#include "coordquantize.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#define BITBUF_BATCH_X86
+#include <immintrin.h>
+#define BITBUF_TARGET_SSE41 __attribute__(( target( "sse4.1" ) ))
+#define BITBUF_TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+
+// x87 keeps f*NORMAL_DENOMINATOR exact before truncating it, SSE rounds it to float first.
+// The vector quantizer has to do what the scalar writers do on this target.
+#if defined( FLT_EVAL_METHOD ) && FLT_EVAL_METHOD == 0
+#define BITBUF_FLOAT_MATH
+#endif
+
+namespace
+{
+	// Values are quantized and dequantized this many at a time
+	const int kBatchSize = 64;
+
+	enum EBatchValue
+	{
+		kBatch_CoordMP,
+		kBatch_CellCoord,
+		kBatch_Normal
+	};
+
+	struct BatchFormat
+	{
+		EBatchValue		m_nValue;
+		EBitCoordType	m_nCoordType;
+		int				m_nCellBits;
+
+		int FractionalBits( void ) const
+		{
+			if ( m_nValue == kBatch_Normal )
+				return NORMAL_FRACTIONAL_BITS;
+
+			return m_nCoordType == kCW_LowPrecision ? COORD_FRACTIONAL_BITS_MP_LOWPRECISION : COORD_FRACTIONAL_BITS;
+		}
+
+		int Denominator( void ) const
+		{
+			return m_nCoordType == kCW_LowPrecision ? COORD_DENOMINATOR_LOWPRECISION : COORD_DENOMINATOR;
+		}
+
+		float Resolution( void ) const
+		{
+			// Both are powers of two, exact as floats
+			return m_nCoordType == kCW_LowPrecision ? (float)COORD_RESOLUTION_LOWPRECISION : (float)COORD_RESOLUTION;
+		}
+	};
+
+	// A coord with its sign as 0 or 1, the integer part and the fraction in denominator units
+	struct UnpackedBatch
+	{
+		int32	m_nInt[kBatchSize];
+		int32	m_nFract[kBatchSize];
+		int32	m_nSign[kBatchSize];
+	};
+
+	// The writers compare against the double NORMAL_RESOLUTION, this is the float that splits the same way
+	float NormalSignLimit( void )
+	{
+		float flLimit = (float)-NORMAL_RESOLUTION;
+		if ( (double)flLimit > -NORMAL_RESOLUTION )
+			flLimit = nextafterf( flLimit, -FLT_MAX );
+		return flLimit;
+	}
+
+	const float s_flNormalSignLimit = NormalSignLimit();
+
+	void QuantizeScalar( const BatchFormat &format, const float *pValues, int nCount, uint32 *pBits, int32 *pNumBits )
+	{
+		for ( int i = 0; i < nCount; ++i )
+		{
+			uint64 nBits = 0;
+			switch ( format.m_nValue )
+			{
+			case kBatch_CoordMP:
+				pNumBits[i] = bitbuf::QuantizeBitCoordMP( pValues[i], format.m_nCoordType, nBits );
+				break;
+			case kBatch_CellCoord:
+				pNumBits[i] = bitbuf::QuantizeBitCellCoord( pValues[i], format.m_nCellBits, format.m_nCoordType, nBits );
+				break;
+			case kBatch_Normal:
+				pNumBits[i] = bitbuf::QuantizeBitNormal( pValues[i], nBits );
+				break;
+			}
+			pBits[i] = (uint32)nBits;
+		}
+	}
+
+	// Same arithmetic as the CBitRead readers, for the values from nStart on
+	void DequantizeScalar( const BatchFormat &format, const UnpackedBatch &batch, int nStart, int nCount, float *pOut )
+	{
+		for ( int i = nStart; i < nCount; ++i )
+		{
+			float value;
+			if ( format.m_nValue == kBatch_Normal )
+			{
+				value = (float)batch.m_nFract[i] * NORMAL_RESOLUTION;
+			}
+			else
+			{
+				value = batch.m_nInt[i] + ( (float)batch.m_nFract[i] * ( format.m_nCoordType == kCW_LowPrecision ? COORD_RESOLUTION_LOWPRECISION : COORD_RESOLUTION ) );
+			}
+
+			if ( batch.m_nSign[i] )
+				value = -value;
+
+			pOut[i] = value;
+		}
+	}
+
+#ifdef BITBUF_BATCH_X86
+	enum ESimdLevel
+	{
+		kSimd_None,
+		kSimd_SSE41,
+		kSimd_AVX2
+	};
+
+	ESimdLevel DetectSimdLevel( void )
+	{
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports( "avx2" ) )
+			return kSimd_AVX2;
+		if ( __builtin_cpu_supports( "sse4.1" ) )
+			return kSimd_SSE41;
+		return kSimd_None;
+	}
+
+	const ESimdLevel s_nSimdLevel = DetectSimdLevel();
+
+	// SSE4.1 has no per lane shifts, multiplying by 2^n does the same for the small n used here
+	BITBUF_TARGET_SSE41 inline __m128i Pow2_SSE41( __m128i n )
+	{
+		__m128i exponent = _mm_slli_epi32( _mm_add_epi32( n, _mm_set1_epi32( 127 ) ), 23 );
+		return _mm_cvttps_epi32( _mm_castsi128_ps( exponent ) );
+	}
+
+	BITBUF_TARGET_SSE41 void Quantize_SSE41( const BatchFormat &format, const float *pValues, int nCount, uint32 *pBits, int32 *pNumBits )
+	{
+		const __m128i vZero = _mm_setzero_si128();
+		const __m128i vOne = _mm_set1_epi32( 1 );
+		const __m128 vDenominator = _mm_set1_ps( (float)format.Denominator() );
+		const __m128i vFractMask = _mm_set1_epi32( format.Denominator() - 1 );
+		const int nFractBits = format.FractionalBits();
+
+		int i = 0;
+		for ( ; i + 4 <= nCount; i += 4 )
+		{
+			__m128 f = _mm_loadu_ps( pValues + i );
+			__m128i intval = _mm_abs_epi32( _mm_cvttps_epi32( f ) );
+			__m128i fractval = _mm_and_si128( _mm_abs_epi32( _mm_cvttps_epi32( _mm_mul_ps( f, vDenominator ) ) ), vFractMask );
+			__m128i bits, numBits;
+
+			if ( format.m_nValue == kBatch_CoordMP )
+			{
+				const __m128 vSignLimit = _mm_set1_ps( -format.Resolution() );
+				__m128i signbit = _mm_srli_epi32( _mm_castps_si128( _mm_cmple_ps( f, vSignLimit ) ), 31 );
+				__m128i inBounds = _mm_cmpgt_epi32( _mm_set1_epi32( 1 << COORD_INTEGER_BITS_MP ), intval );
+				__m128i hasInt = _mm_andnot_si128( _mm_cmpeq_epi32( intval, vZero ), _mm_set1_epi32( -1 ) );
+				__m128i intBits = _mm_and_si128( hasInt, _mm_blendv_epi8( _mm_set1_epi32( COORD_INTEGER_BITS ), _mm_set1_epi32( COORD_INTEGER_BITS_MP ), inBounds ) );
+				__m128i intPart = _mm_and_si128( _mm_sub_epi32( intval, vOne ), _mm_sub_epi32( Pow2_SSE41( intBits ), vOne ) );
+
+				bits = _mm_or_si128( _mm_and_si128( inBounds, vOne ), _mm_and_si128( hasInt, _mm_set1_epi32( 2 ) ) );
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					// The sign and the integer only follow when there is an integer
+					bits = _mm_or_si128( bits, _mm_and_si128( hasInt, _mm_or_si128( _mm_slli_epi32( signbit, 2 ), _mm_slli_epi32( intPart, 3 ) ) ) );
+					numBits = _mm_add_epi32( _mm_set1_epi32( 2 ), _mm_and_si128( hasInt, _mm_add_epi32( vOne, intBits ) ) );
+				}
+				else
+				{
+					__m128i fractShift = _mm_add_epi32( intBits, _mm_set1_epi32( 3 ) );
+					bits = _mm_or_si128( bits, _mm_or_si128( _mm_slli_epi32( signbit, 2 ), _mm_slli_epi32( intPart, 3 ) ) );
+					bits = _mm_or_si128( bits, _mm_mullo_epi32( fractval, Pow2_SSE41( fractShift ) ) );
+					numBits = _mm_add_epi32( fractShift, _mm_set1_epi32( nFractBits ) );
+				}
+			}
+			else if ( format.m_nValue == kBatch_CellCoord )
+			{
+				bits = _mm_and_si128( intval, _mm_set1_epi32( CBitBuffer::s_nMaskTable[format.m_nCellBits] ) );
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					numBits = _mm_set1_epi32( format.m_nCellBits );
+				}
+				else
+				{
+					bits = _mm_or_si128( bits, _mm_sll_epi32( fractval, _mm_cvtsi32_si128( format.m_nCellBits ) ) );
+					numBits = _mm_set1_epi32( format.m_nCellBits + nFractBits );
+				}
+			}
+			else
+			{
+				__m128i signbit = _mm_srli_epi32( _mm_castps_si128( _mm_cmple_ps( f, _mm_set1_ps( s_flNormalSignLimit ) ) ), 31 );
+#ifdef BITBUF_FLOAT_MATH
+				__m128i normal = _mm_cvttps_epi32( _mm_mul_ps( f, _mm_set1_ps( (float)NORMAL_DENOMINATOR ) ) );
+#else
+				const __m128d vNormalDenominator = _mm_set1_pd( NORMAL_DENOMINATOR );
+				__m128i lo = _mm_cvttpd_epi32( _mm_mul_pd( _mm_cvtps_pd( f ), vNormalDenominator ) );
+				__m128i hi = _mm_cvttpd_epi32( _mm_mul_pd( _mm_cvtps_pd( _mm_movehl_ps( f, f ) ), vNormalDenominator ) );
+				__m128i normal = _mm_unpacklo_epi64( lo, hi );
+#endif
+				__m128i normalval = _mm_min_epu32( _mm_abs_epi32( normal ), _mm_set1_epi32( NORMAL_DENOMINATOR ) );
+				bits = _mm_or_si128( signbit, _mm_slli_epi32( normalval, 1 ) );
+				numBits = _mm_set1_epi32( 1 + NORMAL_FRACTIONAL_BITS );
+			}
+
+			_mm_storeu_si128( (__m128i *)( pBits + i ), bits );
+			_mm_storeu_si128( (__m128i *)( pNumBits + i ), numBits );
+		}
+
+		QuantizeScalar( format, pValues + i, nCount - i, pBits + i, pNumBits + i );
+	}
+
+	BITBUF_TARGET_AVX2 void Quantize_AVX2( const BatchFormat &format, const float *pValues, int nCount, uint32 *pBits, int32 *pNumBits )
+	{
+		const __m256i vZero = _mm256_setzero_si256();
+		const __m256i vOne = _mm256_set1_epi32( 1 );
+		const __m256 vDenominator = _mm256_set1_ps( (float)format.Denominator() );
+		const __m256i vFractMask = _mm256_set1_epi32( format.Denominator() - 1 );
+		const int nFractBits = format.FractionalBits();
+
+		int i = 0;
+		for ( ; i + 8 <= nCount; i += 8 )
+		{
+			__m256 f = _mm256_loadu_ps( pValues + i );
+			__m256i intval = _mm256_abs_epi32( _mm256_cvttps_epi32( f ) );
+			__m256i fractval = _mm256_and_si256( _mm256_abs_epi32( _mm256_cvttps_epi32( _mm256_mul_ps( f, vDenominator ) ) ), vFractMask );
+			__m256i bits, numBits;
+
+			if ( format.m_nValue == kBatch_CoordMP )
+			{
+				const __m256 vSignLimit = _mm256_set1_ps( -format.Resolution() );
+				__m256i signbit = _mm256_srli_epi32( _mm256_castps_si256( _mm256_cmp_ps( f, vSignLimit, _CMP_LE_OQ ) ), 31 );
+				__m256i inBounds = _mm256_cmpgt_epi32( _mm256_set1_epi32( 1 << COORD_INTEGER_BITS_MP ), intval );
+				__m256i hasInt = _mm256_andnot_si256( _mm256_cmpeq_epi32( intval, vZero ), _mm256_set1_epi32( -1 ) );
+				__m256i intBits = _mm256_and_si256( hasInt, _mm256_blendv_epi8( _mm256_set1_epi32( COORD_INTEGER_BITS ), _mm256_set1_epi32( COORD_INTEGER_BITS_MP ), inBounds ) );
+				__m256i intPart = _mm256_and_si256( _mm256_sub_epi32( intval, vOne ), _mm256_sub_epi32( _mm256_sllv_epi32( vOne, intBits ), vOne ) );
+
+				bits = _mm256_or_si256( _mm256_and_si256( inBounds, vOne ), _mm256_and_si256( hasInt, _mm256_set1_epi32( 2 ) ) );
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					// The sign and the integer only follow when there is an integer
+					bits = _mm256_or_si256( bits, _mm256_and_si256( hasInt, _mm256_or_si256( _mm256_slli_epi32( signbit, 2 ), _mm256_slli_epi32( intPart, 3 ) ) ) );
+					numBits = _mm256_add_epi32( _mm256_set1_epi32( 2 ), _mm256_and_si256( hasInt, _mm256_add_epi32( vOne, intBits ) ) );
+				}
+				else
+				{
+					__m256i fractShift = _mm256_add_epi32( intBits, _mm256_set1_epi32( 3 ) );
+					bits = _mm256_or_si256( bits, _mm256_or_si256( _mm256_slli_epi32( signbit, 2 ), _mm256_slli_epi32( intPart, 3 ) ) );
+					bits = _mm256_or_si256( bits, _mm256_sllv_epi32( fractval, fractShift ) );
+					numBits = _mm256_add_epi32( fractShift, _mm256_set1_epi32( nFractBits ) );
+				}
+			}
+			else if ( format.m_nValue == kBatch_CellCoord )
+			{
+				bits = _mm256_and_si256( intval, _mm256_set1_epi32( CBitBuffer::s_nMaskTable[format.m_nCellBits] ) );
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					numBits = _mm256_set1_epi32( format.m_nCellBits );
+				}
+				else
+				{
+					bits = _mm256_or_si256( bits, _mm256_sll_epi32( fractval, _mm_cvtsi32_si128( format.m_nCellBits ) ) );
+					numBits = _mm256_set1_epi32( format.m_nCellBits + nFractBits );
+				}
+			}
+			else
+			{
+				__m256i signbit = _mm256_srli_epi32( _mm256_castps_si256( _mm256_cmp_ps( f, _mm256_set1_ps( s_flNormalSignLimit ), _CMP_LE_OQ ) ), 31 );
+#ifdef BITBUF_FLOAT_MATH
+				__m256i normal = _mm256_cvttps_epi32( _mm256_mul_ps( f, _mm256_set1_ps( (float)NORMAL_DENOMINATOR ) ) );
+#else
+				const __m256d vNormalDenominator = _mm256_set1_pd( NORMAL_DENOMINATOR );
+				__m128i lo = _mm256_cvttpd_epi32( _mm256_mul_pd( _mm256_cvtps_pd( _mm256_castps256_ps128( f ) ), vNormalDenominator ) );
+				__m128i hi = _mm256_cvttpd_epi32( _mm256_mul_pd( _mm256_cvtps_pd( _mm256_extractf128_ps( f, 1 ) ), vNormalDenominator ) );
+				__m256i normal = _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+#endif
+				__m256i normalval = _mm256_min_epu32( _mm256_abs_epi32( normal ), _mm256_set1_epi32( NORMAL_DENOMINATOR ) );
+				bits = _mm256_or_si256( signbit, _mm256_slli_epi32( normalval, 1 ) );
+				numBits = _mm256_set1_epi32( 1 + NORMAL_FRACTIONAL_BITS );
+			}
+
+			_mm256_storeu_si256( (__m256i *)( pBits + i ), bits );
+			_mm256_storeu_si256( (__m256i *)( pNumBits + i ), numBits );
+		}
+
+		QuantizeScalar( format, pValues + i, nCount - i, pBits + i, pNumBits + i );
+	}
+
+	// Coords come out exact as floats, the integer and the fraction together have at most 24 bits
+	BITBUF_TARGET_SSE41 void Dequantize_SSE41( const BatchFormat &format, const UnpackedBatch &batch, int nCount, float *pOut )
+	{
+		const __m128 vResolution = _mm_set1_ps( format.Resolution() );
+
+		int i = 0;
+		for ( ; i + 4 <= nCount; i += 4 )
+		{
+			__m128i sign = _mm_slli_epi32( _mm_loadu_si128( (const __m128i *)( batch.m_nSign + i ) ), 31 );
+			__m128 fract = _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)( batch.m_nFract + i ) ) );
+			__m128 value;
+
+			if ( format.m_nValue == kBatch_Normal )
+			{
+				// The readers multiply by the double NORMAL_RESOLUTION
+				const __m128d vNormalResolution = _mm_set1_pd( NORMAL_RESOLUTION );
+				__m128 lo = _mm_cvtpd_ps( _mm_mul_pd( _mm_cvtps_pd( fract ), vNormalResolution ) );
+				__m128 hi = _mm_cvtpd_ps( _mm_mul_pd( _mm_cvtps_pd( _mm_movehl_ps( fract, fract ) ), vNormalResolution ) );
+				value = _mm_movelh_ps( lo, hi );
+			}
+			else
+			{
+				__m128 intval = _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)( batch.m_nInt + i ) ) );
+				value = _mm_add_ps( intval, _mm_mul_ps( fract, vResolution ) );
+			}
+
+			_mm_storeu_ps( pOut + i, _mm_xor_ps( value, _mm_castsi128_ps( sign ) ) );
+		}
+
+		DequantizeScalar( format, batch, i, nCount, pOut );
+	}
+
+	BITBUF_TARGET_AVX2 void Dequantize_AVX2( const BatchFormat &format, const UnpackedBatch &batch, int nCount, float *pOut )
+	{
+		const __m256 vResolution = _mm256_set1_ps( format.Resolution() );
+
+		int i = 0;
+		for ( ; i + 8 <= nCount; i += 8 )
+		{
+			__m256i sign = _mm256_slli_epi32( _mm256_loadu_si256( (const __m256i *)( batch.m_nSign + i ) ), 31 );
+			__m256i fractval = _mm256_loadu_si256( (const __m256i *)( batch.m_nFract + i ) );
+			__m256 value;
+
+			if ( format.m_nValue == kBatch_Normal )
+			{
+				// The readers multiply by the double NORMAL_RESOLUTION
+				const __m256d vNormalResolution = _mm256_set1_pd( NORMAL_RESOLUTION );
+				__m128 lo = _mm256_cvtpd_ps( _mm256_mul_pd( _mm256_cvtepi32_pd( _mm256_castsi256_si128( fractval ) ), vNormalResolution ) );
+				__m128 hi = _mm256_cvtpd_ps( _mm256_mul_pd( _mm256_cvtepi32_pd( _mm256_extracti128_si256( fractval, 1 ) ), vNormalResolution ) );
+				value = _mm256_insertf128_ps( _mm256_castps128_ps256( lo ), hi, 1 );
+			}
+			else
+			{
+				__m256 intval = _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i *)( batch.m_nInt + i ) ) );
+				value = _mm256_add_ps( intval, _mm256_mul_ps( _mm256_cvtepi32_ps( fractval ), vResolution ) );
+			}
+
+			_mm256_storeu_ps( pOut + i, _mm256_xor_ps( value, _mm256_castsi256_ps( sign ) ) );
+		}
+
+		DequantizeScalar( format, batch, i, nCount, pOut );
+	}
+#endif // BITBUF_BATCH_X86
+
+	void Quantize( const BatchFormat &format, const float *pValues, int nCount, uint32 *pBits, int32 *pNumBits )
+	{
+#ifdef BITBUF_BATCH_X86
+		if ( s_nSimdLevel == kSimd_AVX2 )
+			return Quantize_AVX2( format, pValues, nCount, pBits, pNumBits );
+		if ( s_nSimdLevel == kSimd_SSE41 )
+			return Quantize_SSE41( format, pValues, nCount, pBits, pNumBits );
+#endif
+		QuantizeScalar( format, pValues, nCount, pBits, pNumBits );
+	}
+
+	void Dequantize( const BatchFormat &format, const UnpackedBatch &batch, int nCount, float *pOut )
+	{
+#ifdef BITBUF_BATCH_X86
+		// The normal products are only rounded like the readers do when they are done in double
+	#ifndef BITBUF_FLOAT_MATH
+		if ( format.m_nValue != kBatch_Normal )
+	#endif
+		{
+			if ( s_nSimdLevel == kSimd_AVX2 )
+				return Dequantize_AVX2( format, batch, nCount, pOut );
+			if ( s_nSimdLevel == kSimd_SSE41 )
+				return Dequantize_SSE41( format, batch, nCount, pOut );
+		}
+#endif
+		DequantizeScalar( format, batch, 0, nCount, pOut );
+	}
+
+	FORCEINLINE void WriteQuantized( bf_write &buf, uint32 nBits, int nNumBits )
+	{
+		buf.WriteUBitLong( nBits, nNumBits, false );
+	}
+
+	FORCEINLINE void WriteQuantized( CBitWrite64 &buf, uint32 nBits, int nNumBits )
+	{
+		buf.WriteUBit64( nBits, nNumBits );
+	}
+
+	template < typename Writer >
+	void WriteBatch( Writer &buf, const BatchFormat &format, const float *pValues, int nCount )
+	{
+		uint32 nBits[kBatchSize];
+		int32 nNumBits[kBatchSize];
+
+		while ( nCount > 0 )
+		{
+			int nBatch = nCount < kBatchSize ? nCount : kBatchSize;
+			Quantize( format, pValues, nBatch, nBits, nNumBits );
+
+			for ( int i = 0; i < nBatch; ++i )
+				WriteQuantized( buf, nBits[i], nNumBits[i] );
+
+			pValues += nBatch;
+			nCount -= nBatch;
+		}
+	}
+
+	// Bits from nBit on, past the end of the buffer reads as zero. At least 56 are valid.
+	FORCEINLINE uint64 LoadBitWindow( const uint8 *pData, int nBytes, int nBit )
+	{
+		int nByte = nBit >> 3;
+		uint64 nWord = 0;
+		if ( nByte + (int)sizeof(nWord) <= nBytes )
+			memcpy( &nWord, pData + nByte, sizeof(nWord) );
+		else if ( nByte < nBytes )
+			memcpy( &nWord, pData + nByte, nBytes - nByte );
+
+		return LittleQWord( nWord ) >> ( nBit & 7 );
+	}
+
+	// Pulls the fields of nCount values apart starting at nBit, returns the bit after the last one
+	int Unpack( const BatchFormat &format, const uint8 *pData, int nBytes, int nBit, int nCount, UnpackedBatch &batch )
+	{
+		const uint32 nFractMask = CBitBuffer::s_nMaskTable[format.FractionalBits()];
+
+		for ( int i = 0; i < nCount; ++i )
+		{
+			uint64 nWindow = LoadBitWindow( pData, nBytes, nBit );
+
+			if ( format.m_nValue == kBatch_CoordMP )
+			{
+				int bInBounds = nWindow & 1;
+				int bHasInt = ( nWindow >> 1 ) & 1;
+				int nIntBits = bHasInt ? ( bInBounds ? COORD_INTEGER_BITS_MP : COORD_INTEGER_BITS ) : 0;
+
+				batch.m_nInt[i] = bHasInt ? (int32)( ( nWindow >> 3 ) & CBitBuffer::s_nMaskTable[nIntBits] ) + 1 : 0;
+
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					batch.m_nSign[i] = bHasInt ? ( nWindow >> 2 ) & 1 : 0;
+					batch.m_nFract[i] = 0;
+					nBit += bHasInt ? 3 + nIntBits : 2;
+				}
+				else
+				{
+					batch.m_nSign[i] = ( nWindow >> 2 ) & 1;
+					batch.m_nFract[i] = ( nWindow >> ( 3 + nIntBits ) ) & nFractMask;
+					nBit += 3 + nIntBits + format.FractionalBits();
+				}
+			}
+			else if ( format.m_nValue == kBatch_CellCoord )
+			{
+				batch.m_nInt[i] = nWindow & CBitBuffer::s_nMaskTable[format.m_nCellBits];
+				batch.m_nSign[i] = 0;
+
+				if ( format.m_nCoordType == kCW_Integral )
+				{
+					batch.m_nFract[i] = 0;
+					nBit += format.m_nCellBits;
+				}
+				else
+				{
+					batch.m_nFract[i] = ( nWindow >> format.m_nCellBits ) & nFractMask;
+					nBit += format.m_nCellBits + format.FractionalBits();
+				}
+			}
+			else
+			{
+				batch.m_nSign[i] = nWindow & 1;
+				batch.m_nFract[i] = ( nWindow >> 1 ) & nFractMask;
+				batch.m_nInt[i] = 0;
+				nBit += 1 + NORMAL_FRACTIONAL_BITS;
+			}
+		}
+
+		return nBit;
+	}
+
+	void ReadBatch( CBitRead &buf, const BatchFormat &format, float *pOut, int nCount )
+	{
+		UnpackedBatch batch;
+		int nBit = buf.GetNumBitsRead();
+
+		while ( nCount > 0 )
+		{
+			int nBatch = nCount < kBatchSize ? nCount : kBatchSize;
+			nBit = Unpack( format, buf.GetBasePointer(), (int)buf.TotalBytesAvailable(), nBit, nBatch, batch );
+			Dequantize( format, batch, nBatch, pOut );
+
+			pOut += nBatch;
+			nCount -= nBatch;
+		}
+
+		// Past the end this sets the overflow flag like the single value readers would
+		buf.Seek( nBit );
+	}
+
+	// A cell needs to fit in a vector lane when writing and be exact as a float when reading
+	bool CanWriteCellBatch( int bits, EBitCoordType coordType )
+	{
+		int nFractBits = coordType == kCW_Integral ? 0 : ( coordType == kCW_LowPrecision ? COORD_FRACTIONAL_BITS_MP_LOWPRECISION : COORD_FRACTIONAL_BITS );
+		return bits > 0 && bits + nFractBits <= 32;
+	}
+
+	bool CanReadCellBatch( int bits )
+	{
+		return bits > 0 && bits <= 19;
+	}
+}
+
+void bf_write::WriteBitCoordMPArray( const float *pValues, int nCount, EBitCoordType coordType )
+{
+	BatchFormat format = { kBatch_CoordMP, coordType, 0 };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void bf_write::WriteBitCellCoordArray( const float *pValues, int nCount, int bits, EBitCoordType coordType )
+{
+	if ( !CanWriteCellBatch( bits, coordType ) )
+	{
+		for ( int i = 0; i < nCount; ++i )
+			WriteBitCellCoord( pValues[i], bits, coordType );
+		return;
+	}
+
+	BatchFormat format = { kBatch_CellCoord, coordType, bits };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void bf_write::WriteBitNormalArray( const float *pValues, int nCount )
+{
+	BatchFormat format = { kBatch_Normal, kCW_None, 0 };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void CBitWrite64::WriteBitCoordMPArray( const float *pValues, int nCount, EBitCoordType coordType )
+{
+	BatchFormat format = { kBatch_CoordMP, coordType, 0 };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void CBitWrite64::WriteBitCellCoordArray( const float *pValues, int nCount, int bits, EBitCoordType coordType )
+{
+	if ( !CanWriteCellBatch( bits, coordType ) )
+	{
+		for ( int i = 0; i < nCount; ++i )
+			WriteBitCellCoord( pValues[i], bits, coordType );
+		return;
+	}
+
+	BatchFormat format = { kBatch_CellCoord, coordType, bits };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void CBitWrite64::WriteBitNormalArray( const float *pValues, int nCount )
+{
+	BatchFormat format = { kBatch_Normal, kCW_None, 0 };
+	WriteBatch( *this, format, pValues, nCount );
+}
+
+void CBitRead::ReadBitCoordMPArray( float *pOut, int nCount, EBitCoordType coordType )
+{
+	BatchFormat format = { kBatch_CoordMP, coordType, 0 };
+	ReadBatch( *this, format, pOut, nCount );
+}
+
+void CBitRead::ReadBitCellCoordArray( float *pOut, int nCount, int bits, EBitCoordType coordType )
+{
+	if ( !CanReadCellBatch( bits ) )
+	{
+		for ( int i = 0; i < nCount; ++i )
+			pOut[i] = ReadBitCellCoord( bits, coordType );
+		return;
+	}
+
+	BatchFormat format = { kBatch_CellCoord, coordType, bits };
+	ReadBatch( *this, format, pOut, nCount );
+}
+
+void CBitRead::ReadBitNormalArray( float *pOut, int nCount )
+{
+	BatchFormat format = { kBatch_Normal, kCW_None, 0 };
+	ReadBatch( *this, format, pOut, nCount );
+}
@@ -0,0 +1,130 @@
+//========= Copyright ?1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Turns coords and normals into the bits the bitbuf writers put on the wire.
+//			Each function returns the bits in wire order in nBits and how many there
+//			are, so a writer can put a whole value in with one write.
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#ifndef COORDQUANTIZE_H
+#define COORDQUANTIZE_H
+#pragma once
+
+#include <stdlib.h>
+#include "bitbuf.h"
+#include "coordsize.h"
+
+namespace bitbuf
+{
+	// abs( (int)f ) is the same as (int)abs( f ) the writers used, both truncate toward zero
+
+	inline int QuantizeBitCoord( const float f, uint64 &nBits )
+	{
+		int		signbit = (f <= -COORD_RESOLUTION);
+		int		intval = abs( (int)f );
+		int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+		nBits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+		int nNumBits = 2;
+
+		if ( intval || fractval )
+		{
+			nBits |= (uint64)signbit << nNumBits++;
+
+			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+			if ( intval )
+			{
+				nBits |= (uint64)( ( intval - 1 ) & CBitBuffer::s_nMaskTable[COORD_INTEGER_BITS] ) << nNumBits;
+				nNumBits += COORD_INTEGER_BITS;
+			}
+
+			if ( fractval )
+			{
+				nBits |= (uint64)fractval << nNumBits;
+				nNumBits += COORD_FRACTIONAL_BITS;
+			}
+		}
+
+		return nNumBits;
+	}
+
+	inline int QuantizeBitCoordMP( const float f, EBitCoordType coordType, uint64 &nBits )
+	{
+		bool bIntegral = ( coordType == kCW_Integral );
+		bool bLowPrecision = ( coordType == kCW_LowPrecision );
+
+		int		signbit = (f <= -( bLowPrecision ? COORD_RESOLUTION_LOWPRECISION : COORD_RESOLUTION ));
+		int		intval = abs( (int)f );
+		int		fractval = bLowPrecision ?
+			( abs((int)(f*COORD_DENOMINATOR_LOWPRECISION)) & (COORD_DENOMINATOR_LOWPRECISION-1) ) :
+			( abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1) );
+
+		bool	bInBounds = intval < (1 << COORD_INTEGER_BITS_MP );
+		int		nIntegerBits = bInBounds ? COORD_INTEGER_BITS_MP : COORD_INTEGER_BITS;
+
+		nBits = ( bInBounds ? 1 : 0 ) | ( intval ? 2 : 0 );
+		int nNumBits = 2;
+
+		if ( bIntegral )
+		{
+			if ( intval )
+			{
+				nBits |= (uint64)signbit << nNumBits++;
+				nBits |= (uint64)( ( intval - 1 ) & CBitBuffer::s_nMaskTable[nIntegerBits] ) << nNumBits;
+				nNumBits += nIntegerBits;
+			}
+		}
+		else
+		{
+			nBits |= (uint64)signbit << nNumBits++;
+
+			if ( intval )
+			{
+				nBits |= (uint64)( ( intval - 1 ) & CBitBuffer::s_nMaskTable[nIntegerBits] ) << nNumBits;
+				nNumBits += nIntegerBits;
+			}
+
+			nBits |= (uint64)fractval << nNumBits;
+			nNumBits += bLowPrecision ? COORD_FRACTIONAL_BITS_MP_LOWPRECISION : COORD_FRACTIONAL_BITS;
+		}
+
+		return nNumBits;
+	}
+
+	inline int QuantizeBitCellCoord( const float f, int bits, EBitCoordType coordType, uint64 &nBits )
+	{
+		bool bIntegral = ( coordType == kCW_Integral );
+		bool bLowPrecision = ( coordType == kCW_LowPrecision );
+
+		int		intval = abs( (int)f );
+		int		fractval = bLowPrecision ?
+			( abs((int)(f*COORD_DENOMINATOR_LOWPRECISION)) & (COORD_DENOMINATOR_LOWPRECISION-1) ) :
+			( abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1) );
+
+		nBits = intval & CBitBuffer::s_nMaskTable[bits];
+		if ( bIntegral )
+			return bits;
+
+		nBits |= (uint64)fractval << bits;
+		return bits + ( bLowPrecision ? COORD_FRACTIONAL_BITS_MP_LOWPRECISION : COORD_FRACTIONAL_BITS );
+	}
+
+	inline int QuantizeBitNormal( float f, uint64 &nBits )
+	{
+		int	signbit = (f <= -NORMAL_RESOLUTION);
+
+		// NOTE: Since +/-1 are valid values for a normal, I'm going to encode that as all ones
+		unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+
+		// clamp..
+		if (fractval > NORMAL_DENOMINATOR)
+			fractval = NORMAL_DENOMINATOR;
+
+		nBits = signbit | ( (uint64)fractval << 1 );
+		return 1 + NORMAL_FRACTIONAL_BITS;
+	}
+}
+
+#endif // COORDQUANTIZE_H
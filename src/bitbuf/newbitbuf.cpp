@@ -8,6 +8,7 @@
 
 #include "bitbuf.h"
 #include "coordsize.h"
+#include "coordquantize.h"
 #include <cmath>
 #include "stdio.h"
 
@@ -81,6 +82,27 @@ bool CBitWrite::WriteString( const char *pStr )
 }
 
 			 
+// Same encoding CBitRead::ReadVarInt32 and ReadVarInt64 read back
+void CBitWrite::WriteVarInt32( uint32 data )
+{
+	while ( data > 0x7F )
+	{
+		WriteUBitLong( (data & 0x7F) | 0x80, 8 );
+		data >>= 7;
+	}
+	WriteUBitLong( data & 0x7F, 8 );
+}
+
+void CBitWrite::WriteVarInt64( uint64 data )
+{
+	while ( data > 0x7F )
+	{
+		WriteUBitLong( (data & 0x7F) | 0x80, 8 );
+		data >>= 7;
+	}
+	WriteUBitLong( data & 0x7F, 8 );
+}
+
 void CBitWrite::WriteLongLong(int64 val)
 {
 	uint *pLongs = (uint*)&val;
@@ -452,6 +474,45 @@ bool CBitRead::ReadString( char *pStr, int maxLen, bool bLine, int *pOutNumChars
 	return !IsOverflowed() && !bTooSmall;
 }
 
+bool CBitRead::ReadStringView( std::string_view &str )
+{
+	int nPosition = GetNumBitsRead();
+	if ( nPosition & 7 )
+		return false;
+
+	const char *pStart = reinterpret_cast<const char *>( m_pData ) + ( nPosition >> 3 );
+	int nBytesLeft = GetNumBytesLeft();
+	const char *pEnd = nBytesLeft > 0 ? static_cast<const char *>( memchr( pStart, 0, nBytesLeft ) ) : NULL;
+	if ( !pEnd )
+	{
+		Seek( m_nDataBits );
+		SetOverflowFlag();
+		return false;
+	}
+
+	str = std::string_view( pStart, pEnd - pStart );
+	Seek( nPosition + ( (int)( pEnd - pStart + 1 ) << 3 ) );
+	return true;
+}
+
+bool CBitRead::ReadBytesView( std::string_view &bytes, int nBytes )
+{
+	int nPosition = GetNumBitsRead();
+	if ( nPosition & 7 )
+		return false;
+
+	if ( nBytes > GetNumBytesLeft() )
+	{
+		Seek( m_nDataBits );
+		SetOverflowFlag();
+		return false;
+	}
+
+	bytes = std::string_view( reinterpret_cast<const char *>( m_pData ) + ( nPosition >> 3 ), nBytes );
+	Seek( nPosition + ( nBytes << 3 ) );
+	return true;
+}
+
 bool CBitRead::ReadWString( OUT_Z_CAP(maxLenInChars) wchar_t *pStr, int maxLenInChars, bool bLine, int *pOutNumChars )
 {
 	bool bTooSmall = false;
@@ -515,6 +576,39 @@ int64 CBitRead::ReadLongLong( void )
 	return retval;
 }
 
+inline int CBitRead::ReadVarintWindow( int nMaxBytes, uint64 &nResult, bool &bComplete )
+{
+	uint8 const *pNext = reinterpret_cast<uint8 const *>( m_pDataIn );
+	if ( pNext + sizeof(uint64) > reinterpret_cast<uint8 const *>( m_pBufferEnd ) )
+		return 0;
+
+	// The buffered bits and then the next 8 bytes, at least 64 bits of stream. The bits
+	// above m_nBitsAvail are always clear, ReadUBitLong counts on that too
+	uint64 nNext;
+	memcpy( &nNext, pNext, sizeof(nNext) );
+	nNext = LittleQWord( nNext );
+	uint64 nWindow = m_nInBufWord | ( nNext << m_nBitsAvail );
+
+	int nBytes = bitbuf::DecodeVarintWindow( nWindow, nMaxBytes, nResult, bComplete );
+
+	// Skip what was used, refilling the word from the bytes already loaded
+	int nPast = ( nBytes << 3 ) - m_nBitsAvail;
+	if ( nPast < 0 )
+	{
+		m_nInBufWord >>= ( nBytes << 3 );
+		m_nBitsAvail = -nPast;
+	}
+	else
+	{
+		int nWords = nPast >> 5;
+		m_pDataIn += nWords + 1;
+		m_nInBufWord = (uint32)( nNext >> ( nWords << 5 ) ) >> ( nPast & 31 );
+		m_nBitsAvail = 32 - ( nPast & 31 );
+	}
+
+	return nBytes;
+}
+
 // Read 1-5 bytes in order to extract a 32-bit unsigned value from the
 // stream. 7 data bits are extracted from each byte with the 8th bit used
 // to indicate whether the loop should continue.
@@ -528,6 +622,29 @@ int64 CBitRead::ReadLongLong( void )
 // 40-bits: 268435456-0xFFFFFFFF
 uint32 CBitRead::ReadVarInt32()
 {
+	// One and two byte varints come straight out of the buffered word. The word keeps at
+	// least one bit, like ReadUBitLong leaves it.
+	if ( m_nBitsAvail > 8 && !( m_nInBufWord & 0x80 ) )
+	{
+		uint32 nRet = m_nInBufWord & 0x7F;
+		m_nInBufWord >>= 8;
+		m_nBitsAvail -= 8;
+		return nRet;
+	}
+
+	if ( m_nBitsAvail > 16 && ( m_nInBufWord & 0x8080 ) == 0x80 )
+	{
+		uint32 nRet = ( m_nInBufWord & 0x7F ) | ( ( m_nInBufWord >> 1 ) & 0x3F80 );
+		m_nInBufWord >>= 16;
+		m_nBitsAvail -= 16;
+		return nRet;
+	}
+
+	uint64 nWindowResult;
+	bool bComplete;
+	if ( ReadVarintWindow( bitbuf::kMaxVarint32Bytes, nWindowResult, bComplete ) )
+		return (uint32)nWindowResult;
+
 	uint32 result = 0;
 	int count = 0;
 	uint32 b;
@@ -552,6 +669,12 @@ uint64 CBitRead::ReadVarInt64()
 	int count = 0;
 	uint64 b;
 
+	// A varint longer than the window carries on a byte at a time below
+	bool bComplete;
+	count = ReadVarintWindow( sizeof(uint64), result, bComplete );
+	if ( count && bComplete )
+		return result;
+
 	do 
 	{
 		if ( count == bitbuf::kMaxVarintBytes ) 
@@ -566,6 +689,12 @@ uint64 CBitRead::ReadVarInt64()
 	return result;
 }
 
+void CBitRead::ReadVarInt32Array( uint32 *pOut, int nCount )
+{
+	for ( int i = 0; i < nCount; ++i )
+		pOut[i] = ReadVarInt32();
+}
+
 void CBitRead::ReadBits(void *pOutData, int nBits)
 {
 	unsigned char *pOut = (unsigned char*)pOutData;
@@ -780,3 +909,53 @@ float CBitRead::ReadBitNormal (void)
 	return value;
 }
 
+
+
+void CBitWrite64::StartWriting( void *pData, int nBytes, int nBits )
+{
+	m_pData = (uint8 *) pData;
+	m_nDataBytes = nBytes;
+
+	if ( nBits == -1 )
+	{
+		m_nDataBits = nBytes << 3;
+	}
+	else
+	{
+		m_nDataBits = nBits;
+	}
+
+	m_pDataEnd = m_pData + ( m_nDataBits >> 3 );
+	Reset();
+}
+
+// The coord and normal writers encode like bf_write but put all bits of a value in with one write
+
+void CBitWrite64::WriteBitCoord( const float f )
+{
+	uint64 nBits;
+	int nNumBits = bitbuf::QuantizeBitCoord( f, nBits );
+	WriteUBit64( nBits, nNumBits );
+}
+
+void CBitWrite64::WriteBitCoordMP( const float f, EBitCoordType coordType )
+{
+	uint64 nBits;
+	int nNumBits = bitbuf::QuantizeBitCoordMP( f, coordType, nBits );
+	WriteUBit64( nBits, nNumBits );
+}
+
+void CBitWrite64::WriteBitCellCoord( const float f, int bits, EBitCoordType coordType )
+{
+	uint64 nBits;
+	int nNumBits = bitbuf::QuantizeBitCellCoord( f, bits, coordType, nBits );
+	WriteUBit64( nBits, nNumBits );
+}
+
+void CBitWrite64::WriteBitNormal( float f )
+{
+	uint64 nBits;
+	int nNumBits = bitbuf::QuantizeBitNormal( f, nBits );
+	WriteUBit64( nBits, nNumBits );
+}
+
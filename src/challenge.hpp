@@ -0,0 +1,112 @@
+#ifndef __TINY_CSGO_SERVER_CHALLENGE_HPP__
+#define __TINY_CSGO_SERVER_CHALLENGE_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Stateless query challenges. The challenge of a client is SipHash-2-4 of its endpoint and
+// the current time window under a key drawn at startup, so checking one is a single hash
+// and nothing has to be remembered per client. Challenges from the previous window are
+// still accepted so a client that got one right before the window turned isn't bounced.
+
+#include <chrono>
+#include <random>
+#include "common/info_const.hpp"
+
+class ChallengeCookie
+{
+public:
+	ChallengeCookie()
+	{
+		std::random_device rd;
+		m_Key[0] = (static_cast<uint64_t>(rd()) << 32) | rd();
+		m_Key[1] = (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+
+	//ip and port in host byte order
+	uint32_t Generate(uint32_t ip, uint16_t port) const
+	{
+		return Compute(ip, port, CurrentWindow());
+	}
+
+	bool Validate(uint32_t challenge, uint32_t ip, uint16_t port) const
+	{
+		auto window = CurrentWindow();
+		return challenge == Compute(ip, port, window) || challenge == Compute(ip, port, window - 1);
+	}
+
+	//Secret derived from the key for other uses, e.g. seeding a hash table. Different labels give
+	//unrelated values and none of them tells anything about the key or the challenges.
+	uint64_t DeriveKey(uint64_t label) const
+	{
+		//Endpoints only take 48 bits, a label with the top bit set can't be a challenge input
+		return SipHash24(label | (1ULL << 63), ~0ULL);
+	}
+
+private:
+	static uint64_t CurrentWindow()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::seconds>(now).count() / CONFIG_CHALLENGE_WINDOW_SECONDS;
+	}
+
+	uint32_t Compute(uint32_t ip, uint16_t port, uint64_t window) const
+	{
+		auto hash = SipHash24((static_cast<uint64_t>(ip) << 16) | port, window);
+		auto challenge = static_cast<uint32_t>(hash ^ (hash >> 32));
+
+		//-1 is what clients send when they ask for a challenge, never hand that out
+		return challenge == static_cast<uint32_t>(CONNECTIONLESS_HEADER) ? 0 : challenge;
+	}
+
+	static inline uint64_t Rotl(uint64_t x, int b)
+	{
+		return (x << b) | (x >> (64 - b));
+	}
+
+	static inline void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+	{
+		v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32);
+		v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2;
+		v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0;
+		v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32);
+	}
+
+	//SipHash-2-4 of a fixed 16 byte message made of two little endian words
+	uint64_t SipHash24(uint64_t m0, uint64_t m1) const
+	{
+		uint64_t v0 = m_Key[0] ^ 0x736f6d6570736575ULL;
+		uint64_t v1 = m_Key[1] ^ 0x646f72616e646f6dULL;
+		uint64_t v2 = m_Key[0] ^ 0x6c7967656e657261ULL;
+		uint64_t v3 = m_Key[1] ^ 0x7465646279746573ULL;
+
+		for (auto m : { m0, m1 })
+		{
+			v3 ^= m;
+			SipRound(v0, v1, v2, v3);
+			SipRound(v0, v1, v2, v3);
+			v0 ^= m;
+		}
+
+		//Final block only carries the message length
+		uint64_t b = 16ULL << 56;
+		v3 ^= b;
+		SipRound(v0, v1, v2, v3);
+		SipRound(v0, v1, v2, v3);
+		v0 ^= b;
+
+		v2 ^= 0xff;
+		SipRound(v0, v1, v2, v3);
+		SipRound(v0, v1, v2, v3);
+		SipRound(v0, v1, v2, v3);
+		SipRound(v0, v1, v2, v3);
+
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+
+private:
+	uint64_t m_Key[2];
+};
+
+#endif // !__TINY_CSGO_SERVER_CHALLENGE_HPP__
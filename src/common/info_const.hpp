@@ -10,7 +10,45 @@
 //Configs
 _DECL_CONST CONFIG_HANDLE_QUERY_BY_STEAM = 0;
 _DECL_CONST CONNECTIONLESS_HEADER = -1;
-_DECL_CONST A2S_INFO_REQUEST_BODY = "Source Engine Query";
+_DECL_CONST CONFIG_NET_BATCH_SIZE = 64;		//Max datagrams moved per recvmmsg/sendmmsg call
+_DECL_CONST CONFIG_FORWARD_QUEUE_SIZE = 256;	//Datagrams query workers can queue for the main thread, more are dropped
+_DECL_CONST CONFIG_A2S_CHALLENGE_REQUIRED = 1;	//Answer A2S_INFO/A2S_PLAYER only with a valid challenge
+_DECL_CONST CONFIG_CHALLENGE_WINDOW_SECONDS = 30;
+
+//Per source rate limits, tokens per second and burst size of each packet class. Every query worker
+//keeps its own table, and SO_REUSEPORT spreads the datagrams of one address over the workers by
+//source port. A source that keeps changing its port can get up to -threads times these limits.
+_DECL_CONST CONFIG_RATELIMIT_ENABLED = 1;
+_DECL_CONST CONFIG_RATELIMIT_TABLE_SIZE = 16384;	//Sources tracked per worker, power of 2
+_DECL_CONST CONFIG_RATELIMIT_PROBE = 4;			//Slots searched per lookup, power of 2
+_DECL_CONST CONFIG_RATELIMIT_QUERY_RATE = 20u;
+_DECL_CONST CONFIG_RATELIMIT_QUERY_BURST = 40u;
+_DECL_CONST CONFIG_RATELIMIT_CHALLENGE_RATE = 5u;
+_DECL_CONST CONFIG_RATELIMIT_CHALLENGE_BURST = 10u;
+_DECL_CONST CONFIG_RATELIMIT_CONNECT_RATE = 2u;
+_DECL_CONST CONFIG_RATELIMIT_CONNECT_BURST = 5u;
+
+//Logging
+_DECL_CONST CONFIG_LOG_RING_SIZE = 4096;		//Records buffered for the log thread, power of 2
+_DECL_CONST CONFIG_LOG_PACKET_SAMPLE_RATE = 1u;	//Log one of every N received packets at debug level
+_DECL_CONST CONFIG_LOG_SEND_ERROR_SAMPLE_RATE = 1000u;	//Log one of every N failed sends of the io_uring transport
+
+//Mirroring
+_DECL_CONST CONFIG_MIRROR_MIN_INTERVAL_SECONDS = 2;	//Time between two polls of an upstream whose replies just changed
+_DECL_CONST CONFIG_MIRROR_MAX_INTERVAL_SECONDS = 20;	//The time doubles up to this while the replies stay the same
+_DECL_CONST CONFIG_MIRROR_TIMEOUT_MS = 2000;			//Replies arriving later miss the poll
+_DECL_CONST CONFIG_MIRROR_STALE_SECONDS = 30;			//An upstream that hasn't answered for this long is left out of the merge
+
+//Packet sizes and split packets
+inline constexpr size_t MAX_REPLY_SIZE = 10240;				//Largest reply built in one send buffer
+inline constexpr size_t MAX_VERSION_LENGTH = 32;			//-version goes into every A2S_INFO reply
+_DECL_CONST NET_HEADER_FLAG_SPLITPACKET = -2;
+inline constexpr size_t NET_MAX_ROUTABLE_PAYLOAD = 1260;	//Largest datagram we send without splitting
+inline constexpr size_t NET_SPLIT_PAYLOAD_SIZE = 1248;		//Reply bytes carried by one split packet
+inline constexpr size_t NET_SPLIT_HEADER_SIZE = 12;
+inline constexpr size_t MAX_A2S_PLAYER_SIZE = 20480;
+inline constexpr size_t MAX_SPLIT_REPLY_SIZE = MAX_A2S_PLAYER_SIZE + 16;
+inline constexpr size_t NET_MAX_SPLIT_PACKETS = (MAX_SPLIT_REPLY_SIZE + NET_SPLIT_PAYLOAD_SIZE - 1) / NET_SPLIT_PAYLOAD_SIZE;
 
 _DECL_CONST SERVER_REGION_UE = "0";
 _DECL_CONST SERVER_REGION_UW = "1";
@@ -40,8 +78,6 @@ _DECL_CONST SERVER_VALVE_OFFICIAL = 0;
 _DECL_CONST SERVER_REGION = SERVER_REGION_ASIA;
 _DECL_CONST SERVER_PROTOCOL = 17;
 
-_DECL_CONST SERVER_CHALLENGE = 0xdeadbeef;
-
 //Other defines 
 #define PROTOCOL_AUTHCERTIFICATE 0x01   // Connection from client is using a WON authenticated certificate
 #define PROTOCOL_HASHEDCDKEY     0x02	// Connection from client is using hashed CD key because WON comm. channel was unreachable
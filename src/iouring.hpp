@@ -0,0 +1,434 @@
+#ifndef __TINY_CSGO_SERVER_IOURING_HPP__
+#define __TINY_CSGO_SERVER_IOURING_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// io_uring transport for the listen socket, talks to the kernel through the raw syscalls so no liburing is needed.
+// Ingress is one multishot recvmsg feeding from a provided buffer ring registered with the kernel,
+// replies are queued as sendmsg SQEs and submitted together with a single io_uring_enter.
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT)
+#define TINY_CSGO_HAS_IO_URING
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include "common/info_const.hpp"
+#include "logring.hpp"
+
+inline constexpr unsigned	URING_SQ_ENTRIES = 256;
+inline constexpr unsigned	URING_RECV_BUFFERS = 512;				//Has to be a power of 2
+inline constexpr size_t		URING_RECV_BUFFER_SIZE = 2048;
+inline constexpr unsigned	URING_SEND_SLOTS = 128;
+inline constexpr uint16_t	URING_BUFFER_GROUP = 0;
+
+inline constexpr uint64_t	URING_TAG_RECV = 1ull << 63;
+
+class IoUringTransport
+{
+	struct SendSlot
+	{
+		msghdr		m_Hdr;
+		iovec		m_Iov;
+		sockaddr_in	m_To;
+	};
+
+public:
+	~IoUringTransport()
+	{
+		if (m_SqRing && m_SqRing != MAP_FAILED)
+			munmap(m_SqRing, m_SqRingSize);
+		if (m_CqRing && m_CqRing != m_SqRing && m_CqRing != MAP_FAILED)
+			munmap(m_CqRing, m_CqRingSize);
+		if (m_Sqes && m_Sqes != MAP_FAILED)
+			munmap(m_Sqes, m_SqesSize);
+		if (m_BufRing && m_BufRing != MAP_FAILED)
+			munmap(m_BufRing, m_BufRingSize);
+		if (m_RingFd >= 0)
+			close(m_RingFd);
+
+		delete[] m_RecvBuffers;
+		delete[] m_SendArena;
+	}
+
+	//Returns false if the kernel doesn't support what we need, the caller falls back to the reactor
+	bool Init(int socketFd)
+	{
+		m_SocketFd = socketFd;
+
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = URING_SQ_ENTRIES * 4;
+
+		m_RingFd = static_cast<int>(syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params));
+		if (m_RingFd < 0)
+			return false;
+
+		m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap)
+			m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+
+		m_SqRing = mmap(nullptr, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQ_RING);
+		if (m_SqRing == MAP_FAILED)
+			return false;
+
+		m_CqRing = singleMmap ? m_SqRing : mmap(nullptr, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_CQ_RING);
+		if (m_CqRing == MAP_FAILED)
+			return false;
+
+		m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_Sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQES));
+		if (m_Sqes == MAP_FAILED)
+			return false;
+
+		auto* sq = static_cast<char*>(m_SqRing);
+		m_SqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		m_SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_SqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		m_SqEntries = params.sq_entries;
+
+		auto* cq = static_cast<char*>(m_CqRing);
+		m_CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		if (!RegisterBufferRing())
+			return false;
+
+		m_SendArena = new char[URING_SEND_SLOTS * MAX_REPLY_SIZE];
+		for (unsigned i = 0; i < URING_SEND_SLOTS; ++i)
+			m_FreeSendSlots[i] = URING_SEND_SLOTS - 1 - i;
+		m_NumFreeSendSlots = URING_SEND_SLOTS;
+
+		//recvmsg only looks at the name and control lengths, the payload goes to the selected buffer
+		memset(&m_RecvMsg, 0, sizeof(m_RecvMsg));
+		m_RecvMsg.msg_namelen = sizeof(sockaddr_in);
+
+		ArmReceive();
+		if (!Submit())
+			return false;
+
+		//Kernels before 6.0 have the buffer ring but not multishot recvmsg, the arm fails at once then
+		return ProbeReceive();
+	}
+
+	int GetRingFd() const { return m_RingFd; }
+
+	//Set once the receive ended with an error other than running out of buffers.
+	//Nothing is received through the ring anymore, the caller has to switch to another transport.
+	bool HasFailed() const { return m_ReceiveError != 0; }
+	int GetReceiveError() const { return m_ReceiveError; }
+
+	//Hand every received datagram to onDatagram(pData, length, from), returns the number of datagrams seen
+	template<typename Fn>
+	int ProcessCompletions(Fn&& onDatagram)
+	{
+		int count = 0;
+		unsigned head = *m_CqHead;
+		unsigned tail = std::atomic_ref<unsigned>(*m_CqTail).load(std::memory_order_acquire);
+
+		for (; head != tail; ++head)
+		{
+			auto& cqe = m_Cqes[head & m_CqMask];
+			if (!(cqe.user_data & URING_TAG_RECV))
+			{
+				if (cqe.res < 0)
+					LogSendError(-cqe.res);
+
+				ReleaseSendSlot(static_cast<unsigned>(cqe.user_data));
+				continue;
+			}
+
+			//Multishot stops when the buffers run out, arm it again once they're recycled below.
+			//Any other error would come back on every arm.
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+			{
+				if (cqe.res >= 0 || cqe.res == -ENOBUFS)
+				{
+					m_NeedRearm = true;
+				}
+				else
+				{
+					m_ReceiveError = -cqe.res;
+				}
+			}
+
+			if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER))
+				continue;
+
+			auto bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			auto* pBuffer = m_RecvBuffers + bufferId * URING_RECV_BUFFER_SIZE;
+			auto* out = reinterpret_cast<io_uring_recvmsg_out*>(pBuffer);
+
+			if (out->namelen >= sizeof(sockaddr_in) && !(out->flags & MSG_TRUNC))
+			{
+				auto* from = reinterpret_cast<sockaddr_in*>(pBuffer + sizeof(io_uring_recvmsg_out));
+				auto* pPayload = pBuffer + sizeof(io_uring_recvmsg_out) + m_RecvMsg.msg_namelen + m_RecvMsg.msg_controllen;
+				onDatagram(pPayload, static_cast<size_t>(out->payloadlen), *from);
+				++count;
+			}
+
+			RecycleBuffer(bufferId);
+		}
+
+		std::atomic_ref<unsigned>(*m_CqHead).store(head, std::memory_order_release);
+
+		if (m_NeedRearm && !HasFailed())
+			ArmReceive();
+
+		return count;
+	}
+
+	//Reply space comes from the send slots, a slot is busy until its sendmsg completes.
+	//When every slot is in flight the reply is sent synchronously from a scratch buffer instead.
+	char* ReserveReply(size_t maxLength)
+	{
+		//Every slot and the scratch buffer hold the largest reply
+		assert(maxLength <= MAX_REPLY_SIZE);
+		(void)maxLength;
+
+		if (!m_NumFreeSendSlots)
+			return m_OverflowBuf;
+
+		return m_SendArena + m_FreeSendSlots[m_NumFreeSendSlots - 1] * MAX_REPLY_SIZE;
+	}
+
+	void CommitReply(size_t length, const sockaddr_in& to)
+	{
+		//No slot or no room in the submission queue, send what ReserveReply handed out right away
+		auto* sqe = m_NumFreeSendSlots ? GetSqe() : nullptr;
+		if (!sqe)
+		{
+			auto* pData = m_NumFreeSendSlots ? m_SendArena + m_FreeSendSlots[m_NumFreeSendSlots - 1] * MAX_REPLY_SIZE : m_OverflowBuf;
+			if (sendto(m_SocketFd, pData, length, MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&to), sizeof(to)) < 0)
+				LogSendError(errno);
+			return;
+		}
+
+		auto slotIndex = m_FreeSendSlots[--m_NumFreeSendSlots];
+		auto& slot = m_SendSlots[slotIndex];
+
+		slot.m_To = to;
+		slot.m_Iov.iov_base = m_SendArena + slotIndex * MAX_REPLY_SIZE;
+		slot.m_Iov.iov_len = length;
+		memset(&slot.m_Hdr, 0, sizeof(slot.m_Hdr));
+		slot.m_Hdr.msg_name = &slot.m_To;
+		slot.m_Hdr.msg_namelen = sizeof(sockaddr_in);
+		slot.m_Hdr.msg_iov = &slot.m_Iov;
+		slot.m_Hdr.msg_iovlen = 1;
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = m_SocketFd;
+		sqe->addr = reinterpret_cast<uintptr_t>(&slot.m_Hdr);
+		sqe->len = 1;
+		sqe->user_data = slotIndex;
+	}
+
+	//Push every queued SQE to the kernel with one io_uring_enter
+	bool Submit()
+	{
+		while (m_NumPendingSqes)
+		{
+			auto submitted = syscall(__NR_io_uring_enter, m_RingFd, m_NumPendingSqes, 0, 0, nullptr, 0);
+			if (submitted < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				//EAGAIN/EBUSY, the completion queue is backed up. Leave the rest for the next round.
+				return errno == EAGAIN || errno == EBUSY;
+			}
+
+			m_NumPendingSqes -= static_cast<unsigned>(submitted);
+		}
+
+		return true;
+	}
+
+private:
+	bool RegisterBufferRing()
+	{
+		m_BufRingSize = URING_RECV_BUFFERS * sizeof(io_uring_buf);
+		m_BufRing = static_cast<io_uring_buf_ring*>(mmap(nullptr, m_BufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (m_BufRing == MAP_FAILED)
+			return false;
+
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = reinterpret_cast<uintptr_t>(m_BufRing);
+		reg.ring_entries = URING_RECV_BUFFERS;
+		reg.bgid = URING_BUFFER_GROUP;
+
+		if (syscall(__NR_io_uring_register, m_RingFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+			return false;
+
+		m_RecvBuffers = new char[URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE];
+		for (unsigned i = 0; i < URING_RECV_BUFFERS; ++i)
+		{
+			auto& buf = GetRingEntry(i);
+			buf.addr = reinterpret_cast<uintptr_t>(m_RecvBuffers + i * URING_RECV_BUFFER_SIZE);
+			buf.len = URING_RECV_BUFFER_SIZE;
+			buf.bid = static_cast<uint16_t>(i);
+		}
+
+		m_BufRingTail = URING_RECV_BUFFERS;
+		std::atomic_ref<uint16_t>(m_BufRing->tail).store(m_BufRingTail, std::memory_order_release);
+		return true;
+	}
+
+	void RecycleBuffer(uint16_t bufferId)
+	{
+		auto& buf = GetRingEntry(m_BufRingTail & (URING_RECV_BUFFERS - 1));
+		buf.addr = reinterpret_cast<uintptr_t>(m_RecvBuffers + bufferId * URING_RECV_BUFFER_SIZE);
+		buf.len = URING_RECV_BUFFER_SIZE;
+		buf.bid = bufferId;
+
+		++m_BufRingTail;
+		std::atomic_ref<uint16_t>(m_BufRing->tail).store(m_BufRingTail, std::memory_order_release);
+	}
+
+	//The header's flexible array member gets an extra byte of padding in front of it when compiled
+	//as C++, index the ring as a plain array of io_uring_buf the way the kernel sees it.
+	io_uring_buf& GetRingEntry(unsigned index)
+	{
+		return reinterpret_cast<io_uring_buf*>(m_BufRing)[index];
+	}
+
+	//Tried again after the next completions if the submission queue is full
+	void ArmReceive()
+	{
+		auto* sqe = GetSqe();
+		m_NeedRearm = !sqe;
+		if (!sqe)
+			return;
+
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = m_SocketFd;
+		sqe->addr = reinterpret_cast<uintptr_t>(&m_RecvMsg);
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUFFER_GROUP;
+		sqe->user_data = URING_TAG_RECV;
+	}
+
+	//Null if the queue is still full after submitting, the kernel hasn't taken the entries yet
+	//when the completion queue is backed up
+	io_uring_sqe* GetSqe()
+	{
+		unsigned tail = *m_SqTail;
+		if (IsSqFull(tail))
+		{
+			Submit();
+			if (IsSqFull(tail))
+				return nullptr;
+		}
+
+		auto index = tail & m_SqMask;
+		auto* sqe = &m_Sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		m_SqArray[index] = index;
+
+		std::atomic_ref<unsigned>(*m_SqTail).store(tail + 1, std::memory_order_release);
+		++m_NumPendingSqes;
+		return sqe;
+	}
+
+	bool IsSqFull(unsigned tail) const
+	{
+		return tail - std::atomic_ref<unsigned>(*m_SqHead).load(std::memory_order_acquire) >= m_SqEntries;
+	}
+
+	//The arm is checked when it's submitted, an unsupported one has already completed with an error
+	bool ProbeReceive()
+	{
+		unsigned tail = std::atomic_ref<unsigned>(*m_CqTail).load(std::memory_order_acquire);
+		for (unsigned head = *m_CqHead; head != tail; ++head)
+		{
+			auto& cqe = m_Cqes[head & m_CqMask];
+			if ((cqe.user_data & URING_TAG_RECV) && !(cqe.flags & IORING_CQE_F_MORE) && cqe.res < 0 && cqe.res != -ENOBUFS)
+			{
+				errno = -cqe.res;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	//Failed sends only lose their datagram, a few of them are logged so a broken path shows up
+	void LogSendError(int error)
+	{
+		++m_NumSendErrors;
+		if (m_SendErrorSampler.Sample(CONFIG_LOG_SEND_ERROR_SAMPLE_RATE))
+			g_LogRing.Write(LogLevel::Warning, "io_uring send failed with error %d, %llu failed so far\n", error, static_cast<unsigned long long>(m_NumSendErrors));
+	}
+
+	void ReleaseSendSlot(unsigned slotIndex)
+	{
+		if (slotIndex < URING_SEND_SLOTS)
+			m_FreeSendSlots[m_NumFreeSendSlots++] = slotIndex;
+	}
+
+private:
+	int					m_RingFd = -1;
+	int					m_SocketFd = -1;
+
+	void*				m_SqRing = nullptr;
+	void*				m_CqRing = nullptr;
+	size_t				m_SqRingSize = 0;
+	size_t				m_CqRingSize = 0;
+	io_uring_sqe*		m_Sqes = nullptr;
+	size_t				m_SqesSize = 0;
+
+	unsigned*			m_SqHead = nullptr;
+	unsigned*			m_SqTail = nullptr;
+	unsigned*			m_SqArray = nullptr;
+	unsigned			m_SqMask = 0;
+	unsigned			m_SqEntries = 0;
+	unsigned			m_NumPendingSqes = 0;
+
+	unsigned*			m_CqHead = nullptr;
+	unsigned*			m_CqTail = nullptr;
+	unsigned			m_CqMask = 0;
+	io_uring_cqe*		m_Cqes = nullptr;
+
+	io_uring_buf_ring*	m_BufRing = nullptr;
+	size_t				m_BufRingSize = 0;
+	uint16_t			m_BufRingTail = 0;
+	char*				m_RecvBuffers = nullptr;
+	msghdr				m_RecvMsg;
+	bool				m_NeedRearm = false;
+	int					m_ReceiveError = 0;
+
+	char*				m_SendArena = nullptr;
+	SendSlot			m_SendSlots[URING_SEND_SLOTS];
+	unsigned			m_FreeSendSlots[URING_SEND_SLOTS];
+	unsigned			m_NumFreeSendSlots = 0;
+	char				m_OverflowBuf[MAX_REPLY_SIZE];
+	uint64_t			m_NumSendErrors = 0;
+	LogSampler			m_SendErrorSampler;
+};
+
+#endif // __linux__ && IORING_RECV_MULTISHOT
+
+#endif // !__TINY_CSGO_SERVER_IOURING_HPP__
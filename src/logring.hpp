@@ -0,0 +1,202 @@
+#ifndef __TINY_CSGO_SERVER_LOGRING_HPP__
+#define __TINY_CSGO_SERVER_LOGRING_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Asynchronous logging. Network threads only copy the format pointer and the raw arguments
+// into a bounded lock-free ring, a background thread formats the records and writes them out.
+// A full ring drops records instead of making the packet path wait for the terminal.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include "common/info_const.hpp"
+
+enum class LogLevel : uint8_t
+{
+	Debug,
+	Info,
+	Warning,
+	Error
+};
+
+inline constexpr size_t LOG_RECORD_PAYLOAD_SIZE = 32;
+
+class LogRing
+{
+public:
+	LogRing()
+	{
+		for (size_t i = 0; i < CONFIG_LOG_RING_SIZE; ++i)
+			m_Records[i].m_Sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~LogRing()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		if (m_Thread.joinable())
+			return;
+
+		m_Running = true;
+		m_Thread = std::thread([this] { Run(); });
+	}
+
+	//Flushes whatever is left in the ring
+	void Stop()
+	{
+		if (!m_Thread.joinable())
+			return;
+
+		m_Running = false;
+		m_Thread.join();
+	}
+
+	void SetLevel(LogLevel level) { m_MinLevel.store(level, std::memory_order_relaxed); }
+	bool IsEnabled(LogLevel level) const { return level >= m_MinLevel.load(std::memory_order_relaxed); }
+
+	//Safe from any thread. Arguments are copied as they are and formatted later,
+	//so strings passed here have to outlive the record, e.g. literals.
+	template<typename... Args>
+	void Write(LogLevel level, const char* format, Args... args)
+	{
+		using Payload = std::tuple<Args...>;
+		static_assert((std::is_trivially_copyable_v<Args> && ...), "Log arguments are copied raw into the ring");
+		static_assert(sizeof(Payload) <= LOG_RECORD_PAYLOAD_SIZE, "Too many log arguments for one record");
+
+		if (!IsEnabled(level))
+			return;
+
+		//Bounded MPMC queue, a cell is free for position pos when its sequence equals pos
+		auto pos = m_EnqueuePos.load(std::memory_order_relaxed);
+		Record* record;
+		while (true)
+		{
+			record = &m_Records[pos & (CONFIG_LOG_RING_SIZE - 1)];
+			auto diff = static_cast<intptr_t>(record->m_Sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				m_Dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+			{
+				pos = m_EnqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		record->m_Format = format;
+		record->m_pFormatter = &FormatRecord<Args...>;
+		new (record->m_Payload) Payload(args...);
+		record->m_Sequence.store(pos + 1, std::memory_order_release);
+	}
+
+private:
+	using Formatter = int(*)(const char* format, const void* pPayload, char* pOut, size_t size);
+
+	struct alignas(64) Record
+	{
+		std::atomic<size_t>	m_Sequence;
+		const char*			m_Format;
+		Formatter			m_pFormatter;
+		alignas(8) char		m_Payload[LOG_RECORD_PAYLOAD_SIZE];
+	};
+
+	static_assert((CONFIG_LOG_RING_SIZE & (CONFIG_LOG_RING_SIZE - 1)) == 0, "Log ring size has to be a power of 2");
+
+	template<typename... Args>
+	static int FormatRecord(const char* format, const void* pPayload, char* pOut, size_t size)
+	{
+		auto& args = *std::launder(reinterpret_cast<const std::tuple<Args...>*>(pPayload));
+		return std::apply([&](const Args&... a) { return snprintf(pOut, size, format, a...); }, args);
+	}
+
+	//Only the background thread dequeues
+	bool Drain()
+	{
+		char line[1024];
+		bool any = false;
+
+		while (true)
+		{
+			auto& record = m_Records[m_DequeuePos & (CONFIG_LOG_RING_SIZE - 1)];
+			if (record.m_Sequence.load(std::memory_order_acquire) != m_DequeuePos + 1)
+				break;
+
+			auto len = record.m_pFormatter(record.m_Format, record.m_Payload, line, sizeof(line));
+			record.m_Sequence.store(m_DequeuePos + CONFIG_LOG_RING_SIZE, std::memory_order_release);
+			++m_DequeuePos;
+
+			if (len > 0)
+				fwrite(line, 1, std::min(static_cast<size_t>(len), sizeof(line) - 1), stdout);
+
+			any = true;
+		}
+
+		if (auto dropped = m_Dropped.exchange(0, std::memory_order_relaxed))
+		{
+			fprintf(stdout, "Log ring full, %llu records dropped\n", static_cast<unsigned long long>(dropped));
+			any = true;
+		}
+
+		if (any)
+			fflush(stdout);
+
+		return any;
+	}
+
+	void Run()
+	{
+		while (m_Running.load(std::memory_order_relaxed))
+		{
+			if (!Drain())
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+
+		Drain();
+	}
+
+private:
+	Record			m_Records[CONFIG_LOG_RING_SIZE];
+
+	//Producer, consumer and read-mostly state each get their own cache line
+	alignas(64) std::atomic<size_t>		m_EnqueuePos = 0;
+	std::atomic<uint64_t>				m_Dropped = 0;
+	alignas(64) size_t					m_DequeuePos = 0;
+	alignas(64) std::atomic<LogLevel>	m_MinLevel = LogLevel::Info;
+	std::atomic<bool>					m_Running = false;
+	std::thread							m_Thread;
+};
+
+//Lets one of every rate calls through. Not shared between threads, every worker keeps its own.
+class LogSampler
+{
+public:
+	bool Sample(uint32_t rate)
+	{
+		return rate <= 1 || m_Count++ % rate == 0;
+	}
+
+private:
+	uint32_t	m_Count = 0;
+};
+
+inline LogRing g_LogRing;
+
+#endif // !__TINY_CSGO_SERVER_LOGRING_HPP__
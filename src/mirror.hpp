@@ -0,0 +1,420 @@
+#ifndef __TINY_CSGO_SERVER_MIRROR_HPP__
+#define __TINY_CSGO_SERVER_MIRROR_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bitbuf/bitbuf.h"
+#include "common/info_const.hpp"
+#include "common/proto_oob.h"
+#include "packetschema.hpp"
+#include "playertable.hpp"
+#include "serverinfo.hpp"
+
+// Mirrors the info and the players of one or more upstream servers. Every upstream is polled
+// by its own coroutine through its own socket, so a slow or dead one never holds up the rest.
+// After every poll the answers of all upstreams that are still fresh are merged into the server
+// info: name, map and the other fields of the first upstream, player counts summed up and one
+// player list with everybody in it. The A2S caches encode the merged result once per change.
+//
+// An upstream is polled every CONFIG_MIRROR_MIN_INTERVAL_SECONDS while its replies change and
+// twice as long after every poll that brought nothing new, up to CONFIG_MIRROR_MAX_INTERVAL_SECONDS.
+// Info replies are compared by hash, one that is the same as last time isn't parsed again.
+// Player replies are decoded into a PlayerTable and compared by names and scores. Unchanged
+// replies leave the server info and the caches alone.
+
+//What one upstream answered last, everything is copied out of the receive buffer.
+//A new answer is written over the old one, nothing is allocated once the player list has grown.
+struct MirrorSnapshot
+{
+	using Clock = std::chrono::steady_clock;
+
+	enum StringIndex : size_t { Name, Map, GameFolder, Tag, NumStrings };
+
+	uint8_t		m_Protocol = 0;
+	FlatStrings<NumStrings, 1024>	m_Strings;
+	bool		m_HasTag = false;
+	uint8_t		m_NumClients = 0;
+	uint8_t		m_MaxClients = 0;
+	uint8_t		m_NumFakeClients = 0;
+	uint8_t		m_Type = 0;
+	uint8_t		m_OS = 0;
+	uint8_t		m_PasswordNeeded = 0;
+	uint8_t		m_Vac = 0;
+	Clock::time_point	m_InfoTime;
+	uint64_t			m_InfoHash = 0;
+
+	PlayerTable			m_Players;
+	Clock::time_point	m_PlayersTime;
+};
+
+struct MirrorUpstream
+{
+	MirrorUpstream(asio::io_context& context, const asio::ip::udp::endpoint& edp) :
+		m_Socket(context, asio::ip::udp::v4()),
+		m_Edp(edp)
+	{
+		//Connected, so the kernel drops datagrams from anybody else
+		m_Socket.connect(edp);
+	}
+
+	asio::ip::udp::socket	m_Socket;
+	asio::ip::udp::endpoint	m_Edp;
+	char					m_Buf[MAX_REPLY_SIZE];
+	char					m_SendBuf[64];
+	MirrorSnapshot			m_Snapshot;
+};
+
+class MirrorCluster
+{
+	using Clock = MirrorSnapshot::Clock;
+
+public:
+	MirrorCluster(asio::io_context& context) :
+		m_Context(context)
+	{
+	}
+
+	//Starts polling every ip:port of a comma separated list, returns how many were started
+	size_t Start(std::string_view list)
+	{
+		while (!list.empty())
+		{
+			auto comma = list.find(',');
+			auto entry = list.substr(0, comma);
+			list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+			asio::ip::udp::endpoint edp;
+			if (!ParseEndpoint(entry, edp))
+			{
+				printf("Can't resolve mirror upstream address: %.*s\n", static_cast<int>(entry.size()), entry.data());
+				continue;
+			}
+
+			m_Upstreams.push_back(std::make_unique<MirrorUpstream>(m_Context, edp));
+		}
+
+		for (auto& upstream : m_Upstreams)
+			asio::co_spawn(m_Context, Poll(*upstream), asio::detached);
+
+		return m_Upstreams.size();
+	}
+
+private:
+	static bool ParseEndpoint(std::string_view entry, asio::ip::udp::endpoint& edp)
+	{
+		auto colon = entry.rfind(':');
+		if (colon == std::string_view::npos)
+			return false;
+
+		asio::error_code ec;
+		auto address = asio::ip::make_address_v4(std::string(entry.substr(0, colon)), ec);
+		int port = atoi(std::string(entry.substr(colon + 1)).c_str());
+		if (ec || port <= 0 || port > 0xFFFF)
+			return false;
+
+		edp = asio::ip::udp::endpoint(address, static_cast<uint16_t>(port));
+		return true;
+	}
+
+	asio::awaitable<void> Poll(MirrorUpstream& upstream)
+	{
+		static_assert(CONFIG_MIRROR_MAX_INTERVAL_SECONDS * 1000 + CONFIG_MIRROR_TIMEOUT_MS < CONFIG_MIRROR_STALE_SECONDS * 1000,
+			"An upstream that answers every poll must not go stale between two of them");
+
+		constexpr auto minInterval = std::chrono::seconds(CONFIG_MIRROR_MIN_INTERVAL_SECONDS);
+		constexpr auto maxInterval = std::chrono::seconds(CONFIG_MIRROR_MAX_INTERVAL_SECONDS);
+		std::chrono::seconds interval = minInterval;
+
+		while (true)
+		{
+			auto start = Clock::now();
+			if (co_await PollOnce(upstream))
+			{
+				m_Changed = true;
+				interval = minInterval;
+			}
+			else
+			{
+				interval = std::min(interval * 2, maxInterval);
+			}
+
+			Merge();
+
+			asio::steady_timer timer(m_Context, start + interval);
+			co_await timer.async_wait(asio::use_awaitable);
+		}
+	}
+
+	//Asks for the info and the players and takes what comes back before the deadline.
+	//True if the info or the players aren't the same as last time.
+	asio::awaitable<bool> PollOnce(MirrorUpstream& upstream)
+	{
+		auto& socket = upstream.m_Socket;
+
+		//The deadline ends the poll by cancelling the receive, destroying the timer cancels the wait.
+		//It can also pass while a request is being sent, nothing is cancelled then and the check
+		//before the next receive ends the poll.
+		asio::steady_timer deadline(m_Context, std::chrono::milliseconds(CONFIG_MIRROR_TIMEOUT_MS));
+		deadline.async_wait([&socket](const asio::error_code& ec) {
+			if (!ec)
+				socket.cancel();
+		});
+
+		bf_write request(upstream.m_SendBuf, sizeof(upstream.m_SendBuf));
+		A2sInfoRequest::Write(request);
+		co_await Send(upstream, request);
+
+		bool hasInfo = false, hasPlayers = false, askedPlayers = false, changed = false;
+		while ((!hasInfo || !hasPlayers) && Clock::now() < deadline.expiry())
+		{
+			asio::error_code ec;
+			auto length = co_await socket.async_receive(asio::buffer(upstream.m_Buf), asio::redirect_error(asio::use_awaitable, ec));
+			if (ec == asio::error::operation_aborted)
+				break;
+
+			//ICMP errors of an earlier request show up here on a connected socket
+			if (ec)
+				continue;
+
+			bf_read msg(upstream.m_Buf, static_cast<int>(length));
+			if (msg.ReadLong() != CONNECTIONLESS_HEADER)
+				continue;
+
+			switch (msg.ReadByte())
+			{
+			case S2C_CHALLENGE:
+			{
+				int32 challenge;
+				if (!S2cQueryChallengeBody::Read(msg, challenge))
+					break;
+
+				if (!hasInfo)
+				{
+					request.Reset();
+					A2sInfoChallengedRequest::Write(request, challenge);
+					co_await Send(upstream, request);
+				}
+
+				if (!hasPlayers)
+				{
+					request.Reset();
+					A2sPlayerRequest::Write(request, challenge);
+					co_await Send(upstream, request);
+					askedPlayers = true;
+				}
+				break;
+			}
+			case S2A_INFO_SRC:
+			{
+				auto& snapshot = upstream.m_Snapshot;
+				auto hash = HashBytes(upstream.m_Buf, length);
+				if (hash != snapshot.m_InfoHash)
+				{
+					if (!ReadInfo(msg, snapshot))
+						break;
+
+					snapshot.m_InfoHash = hash;
+					changed = true;
+				}
+
+				snapshot.m_InfoTime = Clock::now();
+				hasInfo = true;
+
+				//Servers that answer A2S_INFO without a challenge still want one for A2S_PLAYER
+				if (!askedPlayers)
+				{
+					request.Reset();
+					A2sPlayerRequest::Write(request, -1);
+					co_await Send(upstream, request);
+					askedPlayers = true;
+				}
+				break;
+			}
+			case S2A_PLAYER:
+			{
+				//Decoded into the spare table first, the old one tells whether anything changed.
+				//Kept even when nothing did, the next merge takes the new durations along.
+				auto& snapshot = upstream.m_Snapshot;
+				auto read = static_cast<size_t>(msg.GetNumBytesRead());
+				m_Decoded.Decode(upstream.m_Buf + read, length - read);
+				changed |= !m_Decoded.SamePlayers(snapshot.m_Players);
+				std::swap(m_Decoded, snapshot.m_Players);
+				snapshot.m_PlayersTime = Clock::now();
+
+				hasPlayers = true;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		co_return changed;
+	}
+
+	asio::awaitable<void> Send(MirrorUpstream& upstream, const bf_write& request)
+	{
+		//A lost request only costs this poll, it must not end the coroutine
+		asio::error_code ec;
+		co_await upstream.m_Socket.async_send(asio::buffer(upstream.m_SendBuf, request.GetNumBytesWritten()), asio::redirect_error(asio::use_awaitable, ec));
+	}
+
+	static bool ReadInfo(bf_read& msg, MirrorSnapshot& snapshot)
+	{
+		uint8 protocol, numClients, maxClients, numFakeClients, type, os, passwordNeeded, vac, edf;
+		const char *name, *map, *folder;
+		schema::Ignored ignored;
+		if (!S2aInfoSrcBody::Read(msg, protocol, name, map, folder, ignored, ignored, numClients,
+			maxClients, numFakeClients, type, os, passwordNeeded, vac, ignored, edf))
+			return false;
+
+		//EDF, we discard all but the game tag
+		std::string_view spectatorName, tag;
+		bool hasTag = false;
+
+		if (edf & S2A_EXTRA_DATA_HAS_GAME_PORT)
+			msg.ReadShort();
+
+		if (edf & S2A_EXTRA_DATA_HAS_STEAMID)
+			msg.ReadLongLong();
+
+		if (edf & S2A_EXTRA_DATA_HAS_SPECTATOR_DATA)
+		{
+			msg.ReadShort();
+			msg.ReadStringView(spectatorName);
+		}
+
+		if (edf & S2A_EXTRA_DATA_HAS_GAMETAG_DATA)
+			hasTag = msg.ReadStringView(tag);
+
+		snapshot.m_Protocol = protocol;
+		snapshot.m_Strings.Set(MirrorSnapshot::Name, name);
+		snapshot.m_Strings.Set(MirrorSnapshot::Map, map);
+		snapshot.m_Strings.Set(MirrorSnapshot::GameFolder, folder);
+		snapshot.m_NumClients = numClients;
+		snapshot.m_MaxClients = maxClients;
+		snapshot.m_NumFakeClients = numFakeClients;
+		snapshot.m_Type = type;
+		snapshot.m_OS = os;
+		snapshot.m_PasswordNeeded = passwordNeeded;
+		snapshot.m_Vac = vac;
+		snapshot.m_HasTag = hasTag;
+		if (hasTag)
+			snapshot.m_Strings.Set(MirrorSnapshot::Tag, tag);
+
+		return true;
+	}
+
+	//FNV-1a, only used to tell a reply from the one before it
+	static uint64_t HashBytes(const char* pData, size_t length, uint64_t hash = 14695981039346656037ull)
+	{
+		for (size_t i = 0; i < length; ++i)
+			hash = (hash ^ static_cast<uint8_t>(pData[i])) * 1099511628211ull;
+
+		return hash;
+	}
+
+	static bool IsFresh(Clock::time_point time, Clock::time_point now)
+	{
+		return time != Clock::time_point() && now - time < std::chrono::seconds(CONFIG_MIRROR_STALE_SECONDS);
+	}
+
+	//Only does something if a poll brought news or an upstream went stale or came back
+	void Merge()
+	{
+		auto now = Clock::now();
+
+		bool freshChanged = false;
+		m_Fresh.resize(m_Upstreams.size());
+		for (size_t i = 0; i < m_Upstreams.size(); ++i)
+		{
+			bool fresh = IsFresh(m_Upstreams[i]->m_Snapshot.m_InfoTime, now) || IsFresh(m_Upstreams[i]->m_Snapshot.m_PlayersTime, now);
+			freshChanged |= fresh != m_Fresh[i];
+			m_Fresh[i] = fresh;
+		}
+
+		if (!m_Changed && !freshChanged)
+			return;
+
+		m_Changed = false;
+
+		const MirrorSnapshot* pPrimary = nullptr;
+		int numClients = 0, maxClients = 0, numFakeClients = 0;
+		bool hasPlayers = false;
+
+		m_Merged.Clear();
+
+		for (auto& upstream : m_Upstreams)
+		{
+			auto& snapshot = upstream->m_Snapshot;
+			if (IsFresh(snapshot.m_InfoTime, now))
+			{
+				if (!pPrimary)
+					pPrimary = &snapshot;
+
+				numClients += snapshot.m_NumClients;
+				maxClients += snapshot.m_MaxClients;
+				numFakeClients += snapshot.m_NumFakeClients;
+			}
+
+			//Full tables drop the players of the upstreams behind
+			if (IsFresh(snapshot.m_PlayersTime, now))
+			{
+				m_Merged.Append(snapshot.m_Players);
+				hasPlayers = true;
+			}
+		}
+
+		//Nobody answered for a while, keep showing what was mirrored last
+		if (!pPrimary)
+			return;
+
+		//Everything goes out in one snapshot, a reader never sees half of a merge
+		auto& holder = GetServerInfoHolder();
+		ServerInfo info = *holder.Load();
+
+		info.SetServerProtocol(pPrimary->m_Protocol);
+		info.SetServerName(pPrimary->m_Strings.Get(MirrorSnapshot::Name));
+		info.SetServerMap(pPrimary->m_Strings.Get(MirrorSnapshot::Map));
+		info.SetServerGameFolder(pPrimary->m_Strings.Get(MirrorSnapshot::GameFolder));
+		info.SetServerNumClients(static_cast<uint8_t>(std::min(numClients, 255)));
+		info.SetServerMaxClients(static_cast<uint8_t>(std::min(maxClients, 255)));
+		info.SetServerNumFakeClient(static_cast<uint8_t>(std::min(numFakeClients, 255)));
+		info.SetServerType(pPrimary->m_Type);
+		info.SetServerOS(pPrimary->m_OS);
+		info.SetServerPasswordNeeded(pPrimary->m_PasswordNeeded);
+		info.SetServerVacStatus(pPrimary->m_Vac);
+
+		if (pPrimary->m_HasTag)
+			info.SetServerTag(pPrimary->m_Strings.Get(MirrorSnapshot::Tag));
+
+		//Without any fresh list the default reply with its one entry goes out, not the last list mirrored
+		if (hasPlayers)
+			info.SavePlayers(m_Merged);
+		else
+			info.ClearPlayers();
+
+		holder.Publish(std::move(info));
+	}
+
+private:
+	asio::io_context&								m_Context;
+	std::vector<std::unique_ptr<MirrorUpstream>>	m_Upstreams;
+
+	//Only touched by the polls and Merge, which all run on the thread of the context
+	bool				m_Changed = false;
+	std::vector<bool>	m_Fresh;
+	PlayerTable			m_Decoded;
+	PlayerTable			m_Merged;
+};
+
+#endif // !__TINY_CSGO_SERVER_MIRROR_HPP__
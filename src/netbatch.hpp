@@ -0,0 +1,186 @@
+#ifndef __TINY_CSGO_SERVER_NETBATCH_HPP__
+#define __TINY_CSGO_SERVER_NETBATCH_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Batched datagram engine for linux, a whole burst of queries is pulled with one recvmmsg
+// and every reply produced while handling it leaves with one sendmmsg.
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "common/info_const.hpp"
+
+inline constexpr size_t NETBATCH_RECV_SLOT_SIZE = 2048;
+inline constexpr size_t NETBATCH_SEND_ARENA_SIZE = 256 * 1024;
+
+class DatagramBatch
+{
+public:
+	DatagramBatch(int fd) : m_Fd(fd)
+	{
+		for (int i = 0; i < CONFIG_NET_BATCH_SIZE; ++i)
+		{
+			m_RecvIov[i].iov_base = m_RecvSlots[i];
+			m_RecvIov[i].iov_len = NETBATCH_RECV_SLOT_SIZE;
+		}
+	}
+
+	//Pull every queued datagram up to the batch size without blocking, returns 0 when the socket is drained
+	int Receive()
+	{
+		for (int i = 0; i < CONFIG_NET_BATCH_SIZE; ++i)
+		{
+			auto& hdr = m_RecvHdr[i].msg_hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.msg_name = &m_RecvFrom[i];
+			hdr.msg_namelen = sizeof(sockaddr_in);
+			hdr.msg_iov = &m_RecvIov[i];
+			hdr.msg_iovlen = 1;
+		}
+
+		auto count = recvmmsg(m_Fd, m_RecvHdr, CONFIG_NET_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+		m_NumReceived = count > 0 ? count : 0;
+		return m_NumReceived;
+	}
+
+	int				GetNumReceived() const { return m_NumReceived; }
+	char*			GetData(int index) { return m_RecvSlots[index]; }
+	const sockaddr_in& GetFrom(int index) const { return m_RecvFrom[index]; }
+
+	//Datagrams larger than a slot are truncated, nothing we answer needs more than the slot holds
+	size_t GetLength(int index) const
+	{
+		return m_RecvHdr[index].msg_len < NETBATCH_RECV_SLOT_SIZE ? m_RecvHdr[index].msg_len : NETBATCH_RECV_SLOT_SIZE;
+	}
+
+	//Reply space is handed out from one arena, maxLength has to fit in an empty arena
+	char* ReserveReply(size_t maxLength)
+	{
+		if (!HasRoom(maxLength))
+		{
+			//Out of reply space in the middle of a burst, push out what's queued. Whatever the
+			//socket doesn't take stays queued for the flush after the burst, which waits for POLLOUT.
+			Flush();
+			Compact();
+		}
+
+		//Still full, only this reply is dropped, same as the kernel would do with a full send buffer
+		m_ReplyDropped = !HasRoom(maxLength);
+		return m_ReplyDropped ? m_DropBuf : m_SendArena + m_ArenaUsed;
+	}
+
+	void CommitReply(size_t length, const sockaddr_in& to)
+	{
+		if (m_ReplyDropped)
+			return;
+
+		m_SendIov[m_NumReplies].iov_base = m_SendArena + m_ArenaUsed;
+		m_SendIov[m_NumReplies].iov_len = length;
+		m_SendTo[m_NumReplies] = to;
+		m_ArenaUsed += length;
+		++m_NumReplies;
+	}
+
+	void DiscardReplies()
+	{
+		m_NumReplies = 0;
+		m_NumSent = 0;
+		m_ArenaUsed = 0;
+	}
+
+	//Send everything queued with as few sendmmsg calls as possible.
+	//Returns false if the socket would block, call again once it's writable.
+	bool Flush()
+	{
+		for (int i = m_NumSent; i < m_NumReplies; ++i)
+		{
+			auto& hdr = m_SendHdr[i].msg_hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.msg_name = &m_SendTo[i];
+			hdr.msg_namelen = sizeof(sockaddr_in);
+			hdr.msg_iov = &m_SendIov[i];
+			hdr.msg_iovlen = 1;
+		}
+
+		while (m_NumSent < m_NumReplies)
+		{
+			auto sent = sendmmsg(m_Fd, m_SendHdr + m_NumSent, m_NumReplies - m_NumSent, MSG_DONTWAIT);
+			if (sent > 0)
+			{
+				m_NumSent += sent;
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+
+			if (errno == EINTR)
+				continue;
+
+			//The datagram at the head of the queue can't be sent (e.g. ICMP unreachable), drop it and carry on
+			++m_NumSent;
+		}
+
+		DiscardReplies();
+		return true;
+	}
+
+private:
+	bool HasRoom(size_t maxLength) const
+	{
+		return m_NumReplies < CONFIG_NET_BATCH_SIZE && m_ArenaUsed + maxLength <= sizeof(m_SendArena);
+	}
+
+	//Moves the replies that haven't been sent to the front, they were queued back to back in the arena
+	void Compact()
+	{
+		if (!m_NumSent)
+			return;
+
+		auto* pFirst = static_cast<char*>(m_SendIov[m_NumSent].iov_base);
+		auto offset = static_cast<size_t>(pFirst - m_SendArena);
+		memmove(m_SendArena, pFirst, m_ArenaUsed - offset);
+
+		for (int i = m_NumSent; i < m_NumReplies; ++i)
+		{
+			m_SendIov[i - m_NumSent].iov_base = static_cast<char*>(m_SendIov[i].iov_base) - offset;
+			m_SendIov[i - m_NumSent].iov_len = m_SendIov[i].iov_len;
+			m_SendTo[i - m_NumSent] = m_SendTo[i];
+		}
+
+		m_NumReplies -= m_NumSent;
+		m_ArenaUsed -= offset;
+		m_NumSent = 0;
+	}
+
+private:
+	int			m_Fd;
+
+	mmsghdr		m_RecvHdr[CONFIG_NET_BATCH_SIZE];
+	iovec		m_RecvIov[CONFIG_NET_BATCH_SIZE];
+	sockaddr_in	m_RecvFrom[CONFIG_NET_BATCH_SIZE];
+	char		m_RecvSlots[CONFIG_NET_BATCH_SIZE][NETBATCH_RECV_SLOT_SIZE];
+	int			m_NumReceived = 0;
+
+	mmsghdr		m_SendHdr[CONFIG_NET_BATCH_SIZE];
+	iovec		m_SendIov[CONFIG_NET_BATCH_SIZE];
+	sockaddr_in	m_SendTo[CONFIG_NET_BATCH_SIZE];
+	char		m_SendArena[NETBATCH_SEND_ARENA_SIZE];
+	size_t		m_ArenaUsed = 0;
+	int			m_NumReplies = 0;
+	int			m_NumSent = 0;
+
+	//Handed out for a reply that didn't fit, it's written and then forgotten
+	char		m_DropBuf[MAX_REPLY_SIZE];
+	bool		m_ReplyDropped = false;
+};
+
+#endif // __linux__
+
+#endif // !__TINY_CSGO_SERVER_NETBATCH_HPP__
@@ -0,0 +1,463 @@
+#ifndef __TINY_CSGO_SERVER_PACKETSCHEMA_HPP__
+#define __TINY_CSGO_SERVER_PACKETSCHEMA_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Connectionless message layouts described as types. A message is a list of fields, every
+// field knows its wire size and how to store and load itself. The encoder sums up the size
+// of the whole message and checks it once against the buffer, the decoder checks the part
+// in front of the first string once, strings are bounded by the terminator they must carry.
+// Both work on whole bytes, a message has to start on a byte boundary, which every
+// connectionless packet does.
+
+#include <cstring>
+#include <tuple>
+#include <utility>
+#include "bitbuf/bitbuf.h"
+#include "common/info_const.hpp"
+#include "common/proto_oob.h"
+
+namespace schema
+{
+	//Values go out little endian whatever the host is
+	template<typename T>
+	inline T ToLittle(T value)
+	{
+		if constexpr (sizeof(T) == 2)
+			return static_cast<T>(LittleWord(static_cast<uint16>(value)));
+		else if constexpr (sizeof(T) == 4)
+			return static_cast<T>(LittleDWord(static_cast<uint32>(value)));
+		else if constexpr (sizeof(T) == 8)
+			return static_cast<T>(LittleQWord(static_cast<uint64>(value)));
+		else
+			return value;
+	}
+
+	//Fixed size integer field, stored as T
+	template<typename T>
+	struct Scalar
+	{
+		using Type = T;
+		static constexpr bool	IsConstant = false;
+		static constexpr size_t	FixedSize = sizeof(T);
+
+		static size_t Size(T) { return sizeof(T); }
+
+		static char* Store(char* p, T value)
+		{
+			value = ToLittle(value);
+			memcpy(p, &value, sizeof(T));
+			return p + sizeof(T);
+		}
+
+		//Unchecked loads are only used inside the fixed prefix that was checked up front
+		template<bool Checked>
+		static const char* Load(const char* p, const char* end, T& value)
+		{
+			if (Checked && end - p < static_cast<ptrdiff_t>(sizeof(T)))
+				return nullptr;
+
+			memcpy(&value, p, sizeof(T));
+			value = ToLittle(value);
+			return p + sizeof(T);
+		}
+	};
+
+	struct Byte : Scalar<uint8> { template<typename Writer> static void Write(Writer& buf, uint8 value) { buf.WriteByte(value); } };
+	struct Short : Scalar<int16> { template<typename Writer> static void Write(Writer& buf, int16 value) { buf.WriteShort(value); } };
+	struct Long : Scalar<int32> { template<typename Writer> static void Write(Writer& buf, int32 value) { buf.WriteLong(value); } };
+	struct LongLong : Scalar<int64> { template<typename Writer> static void Write(Writer& buf, int64 value) { buf.WriteLongLong(value); } };
+
+	struct Float : Scalar<uint32>
+	{
+		using Type = float;
+
+		static size_t Size(float) { return sizeof(float); }
+		template<typename Writer> static void Write(Writer& buf, float value) { buf.WriteFloat(value); }
+
+		static char* Store(char* p, float value)
+		{
+			uint32 bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return Scalar<uint32>::Store(p, bits);
+		}
+
+		template<bool Checked>
+		static const char* Load(const char* p, const char* end, float& value)
+		{
+			uint32 bits;
+			p = Scalar<uint32>::Load<Checked>(p, end, bits);
+			memcpy(&value, &bits, sizeof(bits));
+			return p;
+		}
+	};
+
+	//Null terminated string. Decodes to a pointer into the packet, valid as long as the packet is.
+	struct String
+	{
+		using Type = const char*;
+		static constexpr bool	IsConstant = false;
+		static constexpr size_t	FixedSize = 0;
+
+		static size_t Size(const char* value) { return strlen(value) + 1; }
+		template<typename Writer> static void Write(Writer& buf, const char* value) { buf.WriteString(value); }
+
+		static char* Store(char* p, const char* value)
+		{
+			auto size = Size(value);
+			memcpy(p, value, size);
+			return p + size;
+		}
+
+		template<bool>
+		static const char* Load(const char* p, const char* end, const char*& value)
+		{
+			auto terminator = static_cast<const char*>(memchr(p, 0, end - p));
+			if (!terminator)
+				return nullptr;
+
+			value = p;
+			return terminator + 1;
+		}
+	};
+
+	//String literal usable as a template argument
+	template<size_t N>
+	struct Text
+	{
+		constexpr Text(const char (&str)[N])
+		{
+			for (size_t i = 0; i < N; ++i)
+				m_Str[i] = str[i];
+		}
+
+		char m_Str[N];
+	};
+
+	//A value every message of this kind carries. Takes no argument, decoding fails on anything else.
+	template<typename Field, auto Value>
+	struct Constant
+	{
+		using Type = typename Field::Type;
+		static constexpr bool	IsConstant = true;
+		static constexpr size_t	FixedSize = Field::FixedSize;
+
+		static size_t Size() { return FixedSize; }
+		template<typename Writer> static void Write(Writer& buf) { Field::Write(buf, static_cast<Type>(Value)); }
+		static char* Store(char* p) { return Field::Store(p, static_cast<Type>(Value)); }
+
+		template<bool Checked>
+		static const char* Load(const char* p, const char* end)
+		{
+			Type value;
+			p = Field::template Load<Checked>(p, end, value);
+			return p && value == static_cast<Type>(Value) ? p : nullptr;
+		}
+	};
+
+	//Fixed text, with its terminator when Terminated is set. Without one it runs into the next field.
+	template<Text Value, bool Terminated = true>
+	struct ConstantText
+	{
+		static constexpr bool	IsConstant = true;
+		static constexpr size_t	FixedSize = sizeof(Value.m_Str) - (Terminated ? 0 : 1);
+
+		static size_t Size() { return FixedSize; }
+		template<typename Writer> static void Write(Writer& buf) { buf.WriteBytes(Value.m_Str, static_cast<int>(FixedSize)); }
+
+		static char* Store(char* p)
+		{
+			memcpy(p, Value.m_Str, FixedSize);
+			return p + FixedSize;
+		}
+
+		template<bool Checked>
+		static const char* Load(const char* p, const char* end)
+		{
+			if (Checked && end - p < static_cast<ptrdiff_t>(FixedSize))
+				return nullptr;
+
+			return memcmp(p, Value.m_Str, FixedSize) == 0 ? p + FixedSize : nullptr;
+		}
+	};
+
+	//Placeholder for decoded values nobody is interested in
+	struct Ignored
+	{
+		template<typename T>
+		Ignored& operator=(const T&) { return *this; }
+	};
+
+	template<typename... Fields>
+	struct Message
+	{
+		static constexpr size_t NumFields = sizeof...(Fields);
+
+		//Number of fields in front of the first one without a fixed size
+		static constexpr size_t NumPrefixFields = []
+		{
+			constexpr size_t sizes[] = { Fields::FixedSize..., 0 };
+			size_t n = 0;
+			while (n < NumFields && sizes[n])
+				++n;
+			return n;
+		}();
+
+		static constexpr size_t FixedPrefixSize = []
+		{
+			constexpr size_t sizes[] = { Fields::FixedSize..., 0 };
+			size_t size = 0;
+			for (size_t i = 0; i < NumPrefixFields; ++i)
+				size += sizes[i];
+			return size;
+		}();
+
+		static constexpr size_t NumValues = (static_cast<size_t>(!Fields::IsConstant) + ... + 0);
+
+		//Encodes one message, every field that isn't a Constant takes an argument in order
+		template<typename... Args>
+		static bool Write(bf_write& buf, const Args&... args)
+		{
+			static_assert(sizeof...(Args) == NumValues, "Wrong number of values for this message");
+
+			auto values = std::forward_as_tuple(args...);
+			auto size = ForEachField([&]<size_t I, typename Field>() { return FieldSize<I, Field>(values); });
+
+			//The only bounds check, a message that doesn't fit goes through the field writers
+			//so it overflows the buffer exactly like before
+			if (size > static_cast<size_t>(buf.GetNumBytesLeft()))
+			{
+				ForEachField([&]<size_t I, typename Field>() { WriteField<I, Field>(buf, values); return 0; });
+				return !buf.IsOverflowed();
+			}
+
+			//Off a byte boundary the fields still go in without checking each one
+			if ((buf.m_iCurBit & 7) != 0)
+			{
+				auto reserved = buf.Reserve(static_cast<int>(size << 3));
+				ForEachField([&]<size_t I, typename Field>() { WriteField<I, Field>(reserved, values); return 0; });
+				return !buf.IsOverflowed();
+			}
+
+			char* p = reinterpret_cast<char*>(buf.GetData()) + (buf.m_iCurBit >> 3);
+			ForEachField([&]<size_t I, typename Field>() { p = StoreField<I, Field>(p, values); return 0; });
+
+			buf.SeekToBit(buf.m_iCurBit + static_cast<int>(size << 3));
+			return !buf.IsOverflowed();
+		}
+
+		//Decodes one message and moves the reader past it. Every field that isn't a Constant
+		//takes an argument to assign to, schema::Ignored skips one. Nothing is assigned and the
+		//reader doesn't move if the message is truncated or a constant doesn't match.
+		template<typename... Args>
+		static bool Read(bf_read& buf, Args&&... args)
+		{
+			static_assert(sizeof...(Args) == NumValues, "Wrong number of values for this message");
+
+			auto bitsRead = buf.GetNumBitsRead();
+			if (bitsRead & 7)
+				return false;
+
+			auto begin = reinterpret_cast<const char*>(buf.GetBasePointer()) + (bitsRead >> 3);
+			auto end = begin + buf.GetNumBytesLeft();
+			if (end - begin < static_cast<ptrdiff_t>(FixedPrefixSize))
+				return false;
+
+			//Load into the field types first, so a failed read leaves the arguments alone
+			std::tuple<typename ValueField<Fields>::Type...> loaded;
+			const char* p = begin;
+			ForEachField([&]<size_t I, typename Field>()
+			{
+				if (p)
+					p = LoadField<I, Field>(p, end, loaded);
+				return 0;
+			});
+
+			if (!p)
+				return false;
+
+			auto refs = std::forward_as_tuple(args...);
+			ForEachField([&]<size_t I, typename Field>()
+			{
+				if constexpr (!Field::IsConstant)
+					std::get<ValueIndex(I)>(refs) = std::get<I>(loaded);
+				return 0;
+			});
+
+			buf.Seek(bitsRead + static_cast<int>((p - begin) << 3));
+			return true;
+		}
+
+	private:
+		//Constants still get a slot in the loaded tuple, it just stays empty
+		template<typename Field, typename = void>
+		struct ValueField { using Type = Ignored; };
+
+		template<typename Field>
+		struct ValueField<Field, std::enable_if_t<!Field::IsConstant>> { using Type = typename Field::Type; };
+
+		//Argument index of the value field at position field
+		static constexpr size_t ValueIndex(size_t field)
+		{
+			constexpr bool isValue[] = { !Fields::IsConstant..., false };
+			size_t index = 0;
+			for (size_t i = 0; i < field; ++i)
+				index += isValue[i];
+			return index;
+		}
+
+		//Calls fn<I, Field>() for every field in order and sums up what it returns
+		template<typename Fn>
+		static size_t ForEachField(Fn&& fn)
+		{
+			return [&]<size_t... I>(std::index_sequence<I...>)
+			{
+				return (static_cast<size_t>(fn.template operator()<I, Fields>()) + ... + 0);
+			}(std::index_sequence_for<Fields...>{});
+		}
+
+		template<size_t I, typename Field, typename Values>
+		static size_t FieldSize(const Values& values)
+		{
+			if constexpr (Field::IsConstant)
+				return Field::Size();
+			else
+				return Field::Size(std::get<ValueIndex(I)>(values));
+		}
+
+		template<size_t I, typename Field, typename Writer, typename Values>
+		static void WriteField(Writer& buf, const Values& values)
+		{
+			if constexpr (Field::IsConstant)
+				Field::Write(buf);
+			else
+				Field::Write(buf, std::get<ValueIndex(I)>(values));
+		}
+
+		template<size_t I, typename Field, typename Values>
+		static char* StoreField(char* p, const Values& values)
+		{
+			if constexpr (Field::IsConstant)
+				return Field::Store(p);
+			else
+				return Field::Store(p, std::get<ValueIndex(I)>(values));
+		}
+
+		template<size_t I, typename Field, typename Loaded>
+		static const char* LoadField(const char* p, const char* end, Loaded& loaded)
+		{
+			constexpr bool checked = I >= NumPrefixFields;
+			if constexpr (Field::IsConstant)
+				return Field::template Load<checked>(p, end);
+			else
+				return Field::template Load<checked>(p, end, std::get<I>(loaded));
+		}
+	};
+
+	//Prepends the connectionless header and the message type to the fields of a body
+	template<int MessageType, typename Body, typename... Extra>
+	struct Connectionless;
+
+	template<int MessageType, typename... Fields, typename... Extra>
+	struct Connectionless<MessageType, Message<Fields...>, Extra...>
+	{
+		using Result = Message<Constant<Long, CONNECTIONLESS_HEADER>, Constant<Byte, MessageType>, Fields..., Extra...>;
+	};
+
+	template<int MessageType, typename Body, typename... Extra>
+	using ConnectionlessMessage = typename Connectionless<MessageType, Body, Extra...>::Result;
+}
+
+// Messages this server reads and writes. A Body is what follows the header and the type
+// byte, for the places that switch on the type before parsing the rest.
+
+//A2S_INFO, the challenge is optional and read separately
+using A2sInfoBody = schema::Message<schema::ConstantText<A2S_KEY_STRING>>;
+using A2sInfoRequest = schema::ConnectionlessMessage<A2S_INFO, A2sInfoBody>;
+using A2sInfoChallengedRequest = schema::ConnectionlessMessage<A2S_INFO, A2sInfoBody, schema::Long>;
+
+//A2S_PLAYER with a challenge
+using A2sPlayerRequest = schema::ConnectionlessMessage<A2S_PLAYER, schema::Message<>, schema::Long>;
+
+//S2C_CHALLENGE to a query
+using S2cQueryChallengeBody = schema::Message<schema::Long>;
+using S2cQueryChallenge = schema::ConnectionlessMessage<S2C_CHALLENGE, S2cQueryChallengeBody>;
+
+//S2C_CHALLENGE to a client that wants to connect
+using S2cConnectChallenge = schema::ConnectionlessMessage<S2C_CHALLENGE, schema::Message<
+	schema::Long,										//challenge
+	schema::Constant<schema::Long, PROTOCOL_STEAM>,
+	schema::Constant<schema::Short, 0>,					//steam2 encryption key not there anymore
+	schema::LongLong,									//server steam id
+	schema::Constant<schema::Byte, SERVER_VAC_STATES>,
+	schema::String,										//connect0x<challenge>
+	schema::Long,										//version
+	schema::String,										//friends or public
+	schema::Byte,										//password needed
+	schema::Constant<schema::LongLong, -1LL>,			//lobby id
+	schema::Constant<schema::Byte, SERVER_DCFRIENDSREQD>,
+	schema::Byte>>;										//official
+
+//S2C_CONNREJECT with a reason, or with a redirect address glued to the prefix
+using S2cConnReject = schema::ConnectionlessMessage<S2C_CONNREJECT, schema::Message<schema::String>>;
+using S2cConnRedirect = schema::ConnectionlessMessage<S2C_CONNREJECT, schema::Message<
+	schema::ConstantText<"ConnectRedirectAddress:", false>,
+	schema::String>>;
+
+//Answer to a ticket of the tiny csgo client, S2C_CONNECTION or S2C_CONNREJECT
+using S2cTicketResult = schema::Message<schema::Constant<schema::Long, CONNECTIONLESS_HEADER>, schema::Byte>;
+
+//S2A_PLAYER, the mirrored player list is appended to the header as it is
+using S2aPlayerHeader = schema::ConnectionlessMessage<S2A_PLAYER, schema::Message<>>;
+
+//S2A_PLAYER when there is no list to mirror, one player named Max Players
+using S2aPlayerDefault = schema::ConnectionlessMessage<S2A_PLAYER, schema::Message<
+	schema::Constant<schema::Byte, 1>,					//number of players
+	schema::Constant<schema::Byte, 0>,					//index
+	schema::ConstantText<"Max Players">,
+	schema::Long,										//score
+	schema::Float>>;									//duration
+
+//One player of a S2A_PLAYER list, the list is a count byte followed by these
+using S2aPlayerRecord = schema::Message<
+	schema::Byte,		//index
+	schema::String,		//name
+	schema::Long,		//score
+	schema::Float>;		//duration
+
+//Header of every piece of a split packet
+using SplitPacketHeader = schema::Message<
+	schema::Constant<schema::Long, NET_HEADER_FLAG_SPLITPACKET>,
+	schema::Long,										//packet id
+	schema::Byte,										//total number of packets
+	schema::Byte,										//number of this packet
+	schema::Constant<schema::Short, NET_SPLIT_PAYLOAD_SIZE>>;
+
+//S2A_INFO_SRC up to the EDF byte, the extra data behind it depends on the flags
+using S2aInfoSrcBody = schema::Message<
+	schema::Byte,		//protocol
+	schema::String,		//name
+	schema::String,		//map
+	schema::String,		//game folder
+	schema::String,		//game description
+	schema::Short,		//app id
+	schema::Byte,		//players
+	schema::Byte,		//max players
+	schema::Byte,		//bots
+	schema::Byte,		//server type
+	schema::Byte,		//os
+	schema::Byte,		//password needed
+	schema::Byte,		//vac
+	schema::String,		//version
+	schema::Byte>;		//EDF
+
+//What we send, with game port, steam id, tags and game id behind the EDF byte
+using S2aInfoSrc = schema::ConnectionlessMessage<S2A_INFO_SRC, S2aInfoSrcBody,
+	schema::Short,		//game port
+	schema::LongLong,	//steam id
+	schema::String,		//tags
+	schema::LongLong>;	//game id
+
+#endif // !__TINY_CSGO_SERVER_PACKETSCHEMA_HPP__
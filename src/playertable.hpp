@@ -0,0 +1,134 @@
+#ifndef __TINY_CSGO_SERVER_PLAYERTABLE_HPP__
+#define __TINY_CSGO_SERVER_PLAYERTABLE_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <string_view>
+#include <vector>
+#include "bitbuf/bitbuf.h"
+#include "common/info_const.hpp"
+
+// The players of a S2A_PLAYER reply, one column per field. Names sit one after the other in one
+// buffer, each found by offset and length. Decoding and merging work on the columns, the reply
+// bytes are only written again by Encode. The index field isn't kept, records are numbered by
+// their position when encoded. Cleared tables keep their memory, so a table that is filled over
+// and over stops allocating once it's as big as the biggest list it held.
+
+class PlayerTable
+{
+public:
+	//The count goes out in one byte
+	static constexpr size_t MAX_PLAYERS = 255;
+
+	//Index, name terminator, score and duration
+	static constexpr size_t RECORD_OVERHEAD = 1 + 1 + 4 + 4;
+
+	size_t Size() const { return m_Score.size(); }
+	bool Empty() const { return m_Score.empty(); }
+
+	std::string_view Name(size_t i) const { return std::string_view(m_Names.data() + m_NameOffset[i], m_NameLength[i]); }
+	int32 Score(size_t i) const { return m_Score[i]; }
+	float Duration(size_t i) const { return m_Duration[i]; }
+
+	//Bytes Encode writes, the count byte and the records
+	size_t EncodedSize() const { return 1 + Size() * RECORD_OVERHEAD + m_Names.size(); }
+
+	void Clear()
+	{
+		m_NameOffset.clear();
+		m_NameLength.clear();
+		m_Score.clear();
+		m_Duration.clear();
+		m_Names.clear();
+	}
+
+	//False if the table is full or the record would make the encoded list too large for a reply
+	bool Add(std::string_view name, int32 score, float duration)
+	{
+		if (Size() >= MAX_PLAYERS || EncodedSize() + RECORD_OVERHEAD + name.size() > MAX_A2S_PLAYER_SIZE)
+			return false;
+
+		m_NameOffset.push_back(static_cast<uint32_t>(m_Names.size()));
+		m_NameLength.push_back(static_cast<uint16_t>(name.size()));
+		m_Score.push_back(score);
+		m_Duration.push_back(duration);
+		m_Names.insert(m_Names.end(), name.begin(), name.end());
+		return true;
+	}
+
+	//Replaces the table with the count byte and the records behind the S2A_PLAYER type byte.
+	//A record cut short ends the list, the ones before it are kept.
+	void Decode(const char* pData, size_t length)
+	{
+		Clear();
+
+		bf_read in(pData, static_cast<int>(length));
+		int count = in.ReadByte();
+
+		for (int i = 0; i < count && !in.IsOverflowed(); ++i)
+		{
+			in.ReadByte();
+
+			std::string_view name;
+			if (!in.ReadStringView(name))
+				break;
+
+			int32 score = in.ReadLong();
+			float duration = in.ReadFloat();
+			if (in.IsOverflowed() || !Add(name, score, duration))
+				break;
+		}
+	}
+
+	//Writes the count byte and the records, checked once for the whole list
+	bool Encode(bf_write& buf) const
+	{
+		auto out = buf.Reserve(static_cast<int>(EncodedSize() << 3));
+		if (!out)
+			return false;
+
+		out.WriteByte(static_cast<uint8>(Size()));
+		for (size_t i = 0; i < Size(); ++i)
+		{
+			out.WriteByte(static_cast<uint8>(i));
+			out.WriteBytes(m_Names.data() + m_NameOffset[i], m_NameLength[i]);
+			out.WriteByte(0);
+			out.WriteLong(m_Score[i]);
+			out.WriteFloat(m_Duration[i]);
+		}
+
+		return true;
+	}
+
+	//Appends the players of another table until this one is full
+	void Append(const PlayerTable& other)
+	{
+		for (size_t i = 0; i < other.Size(); ++i)
+		{
+			if (!Add(other.Name(i), other.Score(i), other.Duration(i)))
+				break;
+		}
+	}
+
+	//Same players with the same scores, durations left out. They grow on every poll of a server.
+	bool SamePlayers(const PlayerTable& other) const
+	{
+		return m_NameLength == other.m_NameLength && m_Score == other.m_Score && m_Names == other.m_Names;
+	}
+
+	bool operator==(const PlayerTable& other) const
+	{
+		return SamePlayers(other) && m_Duration == other.m_Duration;
+	}
+
+private:
+	std::vector<uint32_t>	m_NameOffset;
+	std::vector<uint16_t>	m_NameLength;
+	std::vector<int32>		m_Score;
+	std::vector<float>		m_Duration;
+	std::vector<char>		m_Names;
+};
+
+#endif // !__TINY_CSGO_SERVER_PLAYERTABLE_HPP__
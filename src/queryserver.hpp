@@ -0,0 +1,938 @@
+#ifndef __TINY_CSGO_SERVER_QUERYSERVER_HPP__
+#define __TINY_CSGO_SERVER_QUERYSERVER_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// The network side of the server: the listen sockets, the query workers and their transports, the
+// forward queue and the answers built from the server info. Everything that needs steam is left to
+// the hooks a derived class implements, Server in server.hpp is the one that runs for real.
+
+#include <asio.hpp>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "argparser.hpp"
+#include "bitbuf/bitbuf.h"
+#include "common/proto_oob.h"
+#include "serverinfo.hpp"
+#include "a2scache.hpp"
+#include "packetschema.hpp"
+#include "challenge.hpp"
+#include "ratelimit.hpp"
+#include "logring.hpp"
+#include "allocstats.hpp"
+#include "netbatch.hpp"
+#include "iouring.hpp"
+#include "mirror.hpp"
+
+using namespace asio::ip;
+using namespace std::chrono_literals;
+
+inline asio::io_context g_IoContext;
+
+#ifdef SO_REUSEPORT
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+enum class NetIoMode : uint8_t
+{
+	Asio,		//One async_receive_from/async_send_to per datagram, works everywhere
+	Mmsg,		//recvmmsg/sendmmsg batches, linux only
+	Uring		//io_uring multishot recvmsg, linux only
+};
+
+//Every query worker owns its socket, receive buffer and bit buffers, so workers never share packet state.
+//Worker 0 runs on g_IoContext and is the only one allowed to touch steam, GC and the mirror.
+struct ServerWorker
+{
+	ServerWorker(udp::socket& socket, bool isMain) :
+		m_Socket(socket),
+		m_WriteBuf(m_SendBuf, sizeof(m_SendBuf)),
+		m_ReadBuf(m_Buf, sizeof(m_Buf)),
+		m_IsMain(isMain)
+	{
+	}
+
+	inline void		ResetWriteBuffer() { m_WriteBuf.Reset(); }
+	//The reader caches the first word, only call this once the buffer holds the new datagram
+	inline void		ResetReadBuffer() { m_ReadBuf.StartReading(m_Buf, m_LastReceivedPacketLength); }
+
+	udp::socket&	m_Socket;
+	char			m_Buf[10240];
+	char			m_SendBuf[MAX_REPLY_SIZE];
+	bf_write		m_WriteBuf;
+	bf_read			m_ReadBuf;
+	uint32_t		m_LastReceivedPacketLength = 0;
+	bool			m_IsMain;
+	A2sInfoCache	m_InfoCache;
+	A2sPlayerCache	m_PlayerCache;
+
+	//Set when the last reply is made of split packets, the reply buffer is unused then.
+	//The first m_NumSplitSent of them are out already.
+	const SplitPacketSet* m_pSplitReply = nullptr;
+	int					m_NumSplitSent = 0;
+
+	//Only the receiving workers have one, forwarded packets were already checked
+	std::unique_ptr<RateLimiter>	m_pLimiter;
+	LogSampler						m_PacketLogSampler;
+
+#ifdef __linux__
+	std::unique_ptr<DatagramBatch>	m_pBatch;
+#endif
+#ifdef TINY_CSGO_HAS_IO_URING
+	std::unique_ptr<IoUringTransport>	m_pUring;
+#endif
+};
+
+//Forwarded datagrams larger than a slot are dropped, steam's queries and the auth tickets are far smaller
+inline constexpr size_t FORWARD_SLOT_SIZE = 2048;
+
+//Datagram received by a worker thread that has to be processed on the main thread
+struct ForwardedPacket
+{
+	char			m_Data[FORWARD_SLOT_SIZE];
+	size_t			m_Length = 0;
+	udp::endpoint	m_From;
+};
+
+//Fixed block for an asio handler that is never queued twice at the same time. asio gives the
+//memory back before it runs the handler, so the next one can take it again.
+class HandlerSlot
+{
+public:
+	void* Allocate(size_t size)
+	{
+		if (m_InUse || size > sizeof(m_Storage))
+			return ::operator new(size);
+
+		m_InUse = true;
+		return m_Storage;
+	}
+
+	void Deallocate(void* p)
+	{
+		if (p == m_Storage)
+			m_InUse = false;
+		else
+			::operator delete(p);
+	}
+
+private:
+	alignas(std::max_align_t) char	m_Storage[256];
+	bool							m_InUse = false;
+};
+
+//Allocator asio finds on a handler that keeps its memory in a HandlerSlot
+template<typename T>
+struct HandlerSlotAllocator
+{
+	using value_type = T;
+
+	explicit HandlerSlotAllocator(HandlerSlot& slot) : m_pSlot(&slot) {}
+	template<typename U> HandlerSlotAllocator(const HandlerSlotAllocator<U>& other) : m_pSlot(other.m_pSlot) {}
+
+	T*		allocate(size_t n) { return static_cast<T*>(m_pSlot->Allocate(sizeof(T) * n)); }
+	void	deallocate(T* p, size_t) { m_pSlot->Deallocate(p); }
+
+	template<typename U> bool operator==(const HandlerSlotAllocator<U>& other) const { return m_pSlot == other.m_pSlot; }
+
+	HandlerSlot*	m_pSlot;
+};
+
+enum class PendingWork : uint8_t
+{
+	None,
+	Reply,			//Reply in the worker's send buffer or split packets, the socket would block
+	SteamPacket		//Outgoing steam packet in the worker's send buffer, the socket would block
+};
+
+//What is left of a datagram after DispatchPacketNow
+struct PendingDispatch
+{
+	PendingWork		m_Work = PendingWork::None;
+	size_t			m_Length = 0;
+	udp::endpoint	m_To;
+};
+
+class QueryServer
+{
+public:
+	QueryServer(ArgParser& parser) :
+		m_ArgParser(parser)
+	{
+		m_VersionInt = GetIntVersionFromString(parser.GetOptionValueString("-version"));
+		m_NumWorkers = std::max<uint32_t>(1, parser.GetOptionValueInt8U("-threads"));
+		m_NetIoMode = GetNetIoModeFromString(parser.GetOptionValueString("-netio"));
+
+		g_LogRing.SetLevel(GetLogLevelFromString(parser.GetOptionValueString("-loglevel")));
+		g_LogRing.Start();
+
+#ifndef SO_REUSEPORT
+		if (m_NumWorkers > 1)
+		{
+			printf("SO_REUSEPORT is not supported on this platform, -threads is ignored\n");
+			m_NumWorkers = 1;
+		}
+#endif
+	}
+
+	virtual ~QueryServer() = default;
+
+public:
+	//Opens the listen sockets once g_IoContext runs, the query workers follow the main socket
+	void StartListening()
+	{
+		asio::co_spawn(g_IoContext, PrepareListenServer(), asio::detached);
+	}
+
+	void RunServer() 
+	{ 
+		g_IoContext.run();
+
+		for (auto& thread : m_WorkerThreads)
+			thread.join();
+	}
+
+	//Safe from any thread, RunServer returns once the main thread and the query workers stopped
+	void StopServer()
+	{
+		asio::post(g_IoContext, [this]
+		{
+			for (auto& context : m_WorkerContexts)
+				context->stop();
+
+			g_IoContext.stop();
+		});
+	}
+
+protected:
+	//Steam's side of the datagrams the main thread can't answer itself, only ever called on the main thread.
+	//HandleSteamPacket returns true when there may be packets to send, GetNextSteamPacket hands them out one by one.
+	virtual bool	HandleSteamPacket(const void* pData, int length, uint32_t ip, uint16_t port) = 0;
+	virtual int		GetNextSteamPacket(void* pOut, int maxLength, uint32_t* pIp, uint16_t* pPort) = 0;
+
+	//Ticket of a tiny csgo client, true if the auth session was started
+	virtual bool	BeginAuthSession(const void* pTicket, int length, uint64_t steamID) = 0;
+
+private:
+	udp::socket OpenListenSocket(asio::io_context& context)
+	{
+		udp::socket socket(context, udp::v4());
+
+#ifdef SO_REUSEPORT
+		//Every worker binds its own socket to the same port, the kernel spreads the datagrams among them
+		if (m_NumWorkers > 1)
+			socket.set_option(reuse_port(true));
+#endif
+
+		socket.bind(udp::endpoint(udp::v4(), m_ArgParser.GetOptionValueInt16U("-port")));
+
+#ifdef COMPILER_MSVC
+		//In some early version of windows, unreachable udp packet will trigger a 10045 error
+		DWORD dwBytesReturned = 0;
+		BOOL bNewBehavior = FALSE;
+		WSAIoctl(socket.native_handle(), SIO_UDP_CONNRESET, &bNewBehavior, sizeof(bNewBehavior), NULL, 0, &dwBytesReturned, NULL, NULL);
+#endif // COMPILER_MSVC
+
+		return socket;
+	}
+
+	void StartQueryWorkers()
+	{
+		//Allocated once, queueing a datagram for the main thread is a copy into a free slot
+		m_pForwardQueue = std::make_unique<ForwardedPacket[]>(CONFIG_FORWARD_QUEUE_SIZE);
+
+		//Forwarded datagrams use their own buffers and caches but reply through the main socket
+		m_pForwardWorker = std::make_unique<ServerWorker>(m_pMainWorker->m_Socket, true);
+
+		for (uint32_t i = 1; i < m_NumWorkers; ++i)
+		{
+			auto context = std::make_unique<asio::io_context>(1);
+			auto socket = std::make_unique<udp::socket>(OpenListenSocket(*context));
+			auto worker = std::make_unique<ServerWorker>(*socket, false);
+
+			asio::co_spawn(*context, ReceivePackets(*worker), asio::detached);
+			m_WorkerThreads.emplace_back([ctx = context.get()]() { ctx->run(); });
+
+			m_WorkerContexts.push_back(std::move(context));
+			m_WorkerSockets.push_back(std::move(socket));
+			m_Workers.push_back(std::move(worker));
+		}
+
+		printf("Started %d query workers on port %d\n", m_NumWorkers, m_ArgParser.GetOptionValueInt16U("-port"));
+	}
+
+	asio::awaitable<void> PrepareListenServer()
+	{
+		udp::socket socket = OpenListenSocket(g_IoContext);
+		ServerWorker worker(socket, true);
+
+		//The main socket has to be bound before the rest join the reuseport group
+		m_pMainWorker = &worker;
+		if (m_NumWorkers > 1)
+			StartQueryWorkers();
+
+		//Upstreams are polled through their own sockets, the listen sockets only see clients
+		if (m_ArgParser.HasOption("-mirror"))
+		{
+			auto* upstreams = m_ArgParser.HasOption("-upstream") ? m_ArgParser.GetOptionValueString("-upstream") : m_ArgParser.GetOptionValueString("-rdip");
+			printf("Mirroring %d upstream servers\n", static_cast<int>(m_Mirror.Start(upstreams)));
+		}
+
+		co_await ReceivePackets(worker);
+	}
+
+	asio::awaitable<void> ReceivePackets(ServerWorker& worker)
+	{
+		//Replies are tried right away whatever the transport, the batched ones pass MSG_DONTWAIT themselves
+		worker.m_Socket.non_blocking(true);
+
+		if (CONFIG_RATELIMIT_ENABLED)
+			worker.m_pLimiter = std::make_unique<RateLimiter>(m_Challenge);
+
+#ifdef TINY_CSGO_HAS_IO_URING
+		if (m_NetIoMode == NetIoMode::Uring)
+		{
+			worker.m_pUring = std::make_unique<IoUringTransport>();
+			if (worker.m_pUring->Init(worker.m_Socket.native_handle()))
+			{
+				co_await HandleIncommingPacketUring(worker);
+				co_return;
+			}
+
+			//Old kernel or io_uring disabled by policy, the reactor still works
+			printf("io_uring is not available (%s), falling back to asio\n", strerror(errno));
+			worker.m_pUring.reset();
+		}
+#endif
+#ifdef __linux__
+		if (m_NetIoMode == NetIoMode::Mmsg)
+		{
+			worker.m_pBatch = std::make_unique<DatagramBatch>(worker.m_Socket.native_handle());
+			co_await HandleIncommingPacketBatched(worker);
+			co_return;
+		}
+#endif
+		co_await HandleIncommingPacket(worker);
+	}
+
+	asio::awaitable<void> HandleIncommingPacket(ServerWorker& worker)
+	{
+		auto& socket = worker.m_Socket;
+
+		//Reads are tried right away as well, the reactor is only involved once the socket would block
+		while (true)
+		{
+			co_await socket.async_wait(socket.wait_read, asio::use_awaitable);
+
+			//Drain what's queued before going back to the reactor. The cap lets the timers
+			//sharing this context run during a flood, the wait completes at once if there's more.
+			for (int i = 0; i < CONFIG_NET_BATCH_SIZE; ++i)
+			{
+				worker.ResetWriteBuffer();
+
+				udp::endpoint edp;
+				asio::error_code ec;
+				worker.m_LastReceivedPacketLength = static_cast<uint32_t>(socket.receive_from(asio::buffer(worker.m_Buf), edp, 0, ec));
+				if (ec == asio::error::would_block || ec == asio::error::try_again)
+					break;
+
+				//Errors like ICMP port unreachable of an earlier reply belong to no datagram
+				if (ec)
+					continue;
+
+				if (!AllowPacket(worker, worker.m_Buf, worker.m_LastReceivedPacketLength, edp.address().to_v4().to_uint()))
+					continue;
+
+				worker.ResetReadBuffer();
+
+				if (!worker.m_IsMain)
+				{
+					//Query workers only answer what they can build from the shared server info, the rest belongs to the main thread
+					if (ProcessConnectionlessPacket(worker, worker.m_ReadBuf, worker.m_WriteBuf, edp))
+					{
+						if (!TrySendReply(worker, edp))
+							co_await SendReply(worker, edp);
+					}
+					else
+					{
+						ForwardToMainThread(worker.m_Buf, worker.m_LastReceivedPacketLength, edp);
+					}
+
+					continue;
+				}
+
+				auto pending = DispatchPacketNow(worker, edp);
+				if (pending.m_Work != PendingWork::None)
+					co_await FinishDispatch(worker, edp, pending);
+			}
+		}
+	}
+
+	//Handles a datagram on the main thread as far as it can go without suspending
+	PendingDispatch DispatchPacketNow(ServerWorker& worker, const udp::endpoint& edp)
+	{
+		LogPacket(worker, edp.address().to_v4().to_uint(), edp.port(), worker.m_LastReceivedPacketLength);
+
+		if (ProcessConnectionlessPacket(worker, worker.m_ReadBuf, worker.m_WriteBuf, edp))
+		{
+			if (TrySendReply(worker, edp))
+				return {};
+
+			return { PendingWork::Reply, 0, {} };
+		}
+
+		if (!HandleSteamPacket(worker.m_Buf, worker.m_LastReceivedPacketLength, edp.address().to_v4().to_uint(), edp.port()))
+			return {};
+
+		return SendSteamPacketsNow(worker);
+	}
+
+	//Sends what steam has queued until the socket would block
+	PendingDispatch SendSteamPacketsNow(ServerWorker& worker)
+	{
+		while (true)
+		{
+			uint32_t netadrAddress;
+			uint16_t netadrPort;
+
+			auto len = GetNextSteamPacket(worker.m_SendBuf, sizeof(worker.m_SendBuf), &netadrAddress, &netadrPort);
+			if (len <= 0)
+				return {};
+
+			udp::endpoint dest(make_address_v4(netadrAddress), netadrPort);
+			if (!TrySendTo(worker.m_Socket, asio::buffer(worker.m_SendBuf, len), dest))
+				return { PendingWork::SteamPacket, static_cast<size_t>(len), dest };
+		}
+	}
+
+	//The part of a datagram that has to wait, kept out of the common path so an inline reply costs no coroutine frame
+	asio::awaitable<void> FinishDispatch(ServerWorker& worker, const udp::endpoint& edp, PendingDispatch pending)
+	{
+		switch (pending.m_Work)
+		{
+		case PendingWork::Reply:
+			co_await SendReply(worker, edp);
+			break;
+		case PendingWork::SteamPacket:
+			while (pending.m_Work == PendingWork::SteamPacket)
+			{
+				co_await worker.m_Socket.async_send_to(asio::buffer(worker.m_SendBuf, pending.m_Length), pending.m_To, asio::use_awaitable);
+				pending = SendSteamPacketsNow(worker);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	//Send without suspending, false if the socket would block and the caller has to wait for it
+	bool TrySendTo(udp::socket& socket, const asio::const_buffer& buffer, const udp::endpoint& edp)
+	{
+		asio::error_code ec;
+		socket.send_to(buffer, edp, 0, ec);
+
+		//Other errors mean the datagram is lost anyway, waiting wouldn't help
+		return ec != asio::error::would_block && ec != asio::error::try_again;
+	}
+
+	//Sends the reply without suspending, false if the socket would block and SendReply has to send the rest
+	bool TrySendReply(ServerWorker& worker, const udp::endpoint& edp)
+	{
+		auto* pSplit = worker.m_pSplitReply;
+		if (!pSplit)
+			return TrySendTo(worker.m_Socket, asio::buffer(worker.m_SendBuf, worker.m_WriteBuf.GetNumBytesWritten()), edp);
+
+		for (; worker.m_NumSplitSent < pSplit->GetNumPackets(); ++worker.m_NumSplitSent)
+		{
+			if (!TrySendTo(worker.m_Socket, asio::buffer(pSplit->GetPacket(worker.m_NumSplitSent), pSplit->GetPacketLength(worker.m_NumSplitSent)), edp))
+				return false;
+		}
+
+		worker.m_pSplitReply = nullptr;
+		return true;
+	}
+
+	//Whatever TrySendReply couldn't send
+	asio::awaitable<void> SendReply(ServerWorker& worker, const udp::endpoint& edp)
+	{
+		auto* pSplit = std::exchange(worker.m_pSplitReply, nullptr);
+		if (!pSplit)
+		{
+			co_await worker.m_Socket.async_send_to(asio::buffer(worker.m_SendBuf, worker.m_WriteBuf.GetNumBytesWritten()), edp, asio::use_awaitable);
+			co_return;
+		}
+
+		for (int i = worker.m_NumSplitSent; i < pSplit->GetNumPackets(); ++i)
+		{
+			auto buffer = asio::buffer(pSplit->GetPacket(i), pSplit->GetPacketLength(i));
+			if (!TrySendTo(worker.m_Socket, buffer, edp))
+				co_await worker.m_Socket.async_send_to(buffer, edp, asio::use_awaitable);
+		}
+	}
+
+#ifdef __linux__
+	asio::awaitable<void> HandleIncommingPacketBatched(ServerWorker& worker)
+	{
+		auto& socket = worker.m_Socket;
+		auto& batch = *worker.m_pBatch;
+
+		while (true)
+		{
+			co_await socket.async_wait(socket.wait_read, asio::use_awaitable);
+
+			//A full batch means there may be more queued, keep pulling before going back to the reactor
+			int count;
+			do
+			{
+				count = batch.Receive();
+				for (int i = 0; i < count; ++i)
+					ProcessDatagram(worker, batch.GetData(i), batch.GetLength(i), batch.GetFrom(i), batch);
+
+				while (!batch.Flush())
+					co_await socket.async_wait(socket.wait_write, asio::use_awaitable);
+
+			} while (count == CONFIG_NET_BATCH_SIZE);
+		}
+	}
+
+#ifdef TINY_CSGO_HAS_IO_URING
+	asio::awaitable<void> HandleIncommingPacketUring(ServerWorker& worker)
+	{
+		auto& uring = *worker.m_pUring;
+
+		//The ring fd polls readable while completions are queued, so the reactor can wake us up
+		asio::posix::stream_descriptor ring(worker.m_Socket.get_executor(), dup(uring.GetRingFd()));
+
+		while (true)
+		{
+			co_await ring.async_wait(asio::posix::stream_descriptor::wait_read, asio::use_awaitable);
+
+			uring.ProcessCompletions([&](char* pData, size_t length, const sockaddr_in& from) {
+				ProcessDatagram(worker, pData, length, from, uring);
+			});
+			uring.Submit();
+
+			//The transport stays alive, sends still in flight point into its buffers
+			if (uring.HasFailed())
+			{
+				g_LogRing.Write(LogLevel::Warning, "io_uring receive failed with error %d, falling back to asio\n", uring.GetReceiveError());
+				break;
+			}
+		}
+
+		co_await HandleIncommingPacket(worker);
+	}
+#endif // TINY_CSGO_HAS_IO_URING
+
+	//Shared by the batched transports, Sink hands out reply space with ReserveReply/CommitReply
+	template<typename Sink>
+	void ProcessDatagram(ServerWorker& worker, char* pData, size_t length, const sockaddr_in& from, Sink& sink)
+	{
+		udp::endpoint edp(address_v4(ntohl(from.sin_addr.s_addr)), ntohs(from.sin_port));
+
+		if (!AllowPacket(worker, pData, length, ntohl(from.sin_addr.s_addr)))
+			return;
+
+		if (worker.m_IsMain)
+			LogPacket(worker, ntohl(from.sin_addr.s_addr), ntohs(from.sin_port), length);
+
+		bf_read msg(pData, static_cast<int>(length));
+		bf_write reply(sink.ReserveReply(MAX_REPLY_SIZE), MAX_REPLY_SIZE);
+
+		if (ProcessConnectionlessPacket(worker, msg, reply, edp))
+		{
+			//Split packets are queued back to back so the whole set leaves with the rest of the batch
+			if (auto* pSplit = std::exchange(worker.m_pSplitReply, nullptr))
+			{
+				for (int i = 0; i < pSplit->GetNumPackets(); ++i)
+				{
+					memcpy(sink.ReserveReply(pSplit->GetPacketLength(i)), pSplit->GetPacket(i), pSplit->GetPacketLength(i));
+					sink.CommitReply(pSplit->GetPacketLength(i), from);
+				}
+				return;
+			}
+
+			sink.CommitReply(reply.GetNumBytesWritten(), from);
+			return;
+		}
+
+		if (!worker.m_IsMain)
+		{
+			ForwardToMainThread(pData, length, edp);
+			return;
+		}
+
+		if (!HandleSteamPacket(pData, static_cast<int>(length), ntohl(from.sin_addr.s_addr), ntohs(from.sin_port)))
+			return;
+
+		while (true)
+		{
+			uint32_t netadrAddress;
+			uint16_t netadrPort;
+
+			auto len = GetNextSteamPacket(sink.ReserveReply(MAX_REPLY_SIZE), MAX_REPLY_SIZE, &netadrAddress, &netadrPort);
+			if (len <= 0)
+				break;
+
+			sockaddr_in dest = {};
+			dest.sin_family = AF_INET;
+			dest.sin_addr.s_addr = htonl(netadrAddress);
+			dest.sin_port = htons(netadrPort);
+			sink.CommitReply(len, dest);
+		}
+	}
+#endif // __linux__
+
+	//Called from worker threads, queue the datagram and make sure the main thread is draining the queue.
+	//The queue is bounded, when the main thread falls behind the datagrams that don't fit are dropped.
+	void ForwardToMainThread(const char* pData, size_t length, const udp::endpoint& from)
+	{
+		//Steam only takes connectionless packets, anything else would just take a slot
+		int32_t header = 0;
+		if (length >= sizeof(header))
+			memcpy(&header, pData, sizeof(header));
+
+		if (header != CONNECTIONLESS_HEADER || length > FORWARD_SLOT_SIZE)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_ForwardLock);
+			if (m_ForwardCount == CONFIG_FORWARD_QUEUE_SIZE)
+			{
+				++m_ForwardDropped;
+				return;
+			}
+
+			auto& packet = m_pForwardQueue[(m_ForwardHead + m_ForwardCount) % CONFIG_FORWARD_QUEUE_SIZE];
+			memcpy(packet.m_Data, pData, length);
+			packet.m_Length = length;
+			packet.m_From = from;
+			++m_ForwardCount;
+
+			if (m_ForwardDraining)
+				return;
+
+			m_ForwardDraining = true;
+		}
+
+		asio::post(g_IoContext, DrainHandler{ this });
+	}
+
+	//Posted by ForwardToMainThread, m_ForwardDraining makes sure only one is queued at a time
+	struct DrainHandler
+	{
+		using allocator_type = HandlerSlotAllocator<void>;
+
+		allocator_type	get_allocator() const { return allocator_type(m_pServer->m_DrainHandlerSlot); }
+		void			operator()() const { m_pServer->DrainForwardedPackets(); }
+
+		QueryServer*	m_pServer;
+	};
+
+	//Runs on the main thread until the queue is empty, only a reply the socket can't take yet suspends
+	void DrainForwardedPackets()
+	{
+		auto& worker = *m_pForwardWorker;
+
+		udp::endpoint from;
+		while (PopForwardedPacket(worker, from))
+		{
+			auto pending = DispatchPacketNow(worker, from);
+			if (pending.m_Work != PendingWork::None)
+			{
+				//The rest of the queue waits until this one is out
+				asio::co_spawn(g_IoContext, FinishForwardedPacket(from, pending), asio::detached);
+				return;
+			}
+		}
+	}
+
+	asio::awaitable<void> FinishForwardedPacket(udp::endpoint from, PendingDispatch pending)
+	{
+		co_await FinishDispatch(*m_pForwardWorker, from, pending);
+		DrainForwardedPackets();
+	}
+
+	//Moves the oldest forwarded datagram into the worker's buffers. False when the queue is empty,
+	//the next forwarded datagram starts a new drain then.
+	bool PopForwardedPacket(ServerWorker& worker, udp::endpoint& from)
+	{
+		uint64_t dropped = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_ForwardLock);
+			if (!m_ForwardCount)
+			{
+				m_ForwardDraining = false;
+				return false;
+			}
+
+			//Copied out so the slot is free again before the datagram is handled
+			auto& packet = m_pForwardQueue[m_ForwardHead];
+			memcpy(worker.m_Buf, packet.m_Data, packet.m_Length);
+			worker.m_LastReceivedPacketLength = static_cast<uint32_t>(packet.m_Length);
+			from = packet.m_From;
+			m_ForwardHead = (m_ForwardHead + 1) % CONFIG_FORWARD_QUEUE_SIZE;
+			--m_ForwardCount;
+
+			dropped = std::exchange(m_ForwardDropped, 0);
+		}
+
+		if (dropped)
+			g_LogRing.Write(LogLevel::Warning, "Forward queue full, dropped %llu datagrams\n", static_cast<unsigned long long>(dropped));
+
+		worker.ResetWriteBuffer();
+		worker.ResetReadBuffer();
+		return true;
+	}
+
+	//Build the reply of a connectionless packet into reply, returns false if the packet isn't ours to answer
+	bool ProcessConnectionlessPacket(ServerWorker& worker, bf_read& msg, bf_write& reply, const udp::endpoint& remote_endpoint)
+	{
+		if (msg.ReadLong() != CONNECTIONLESS_HEADER)
+			return false;
+
+		reply.Reset();
+		int c = msg.ReadByte();
+		switch (c)
+		{
+		case A2S_INFO:
+		{
+			if (CONFIG_HANDLE_QUERY_BY_STEAM)
+				return false;
+
+			if (!A2sInfoBody::Read(msg))
+				return false;
+
+			if (!CheckQueryChallenge(msg, reply, remote_endpoint))
+				return true;
+
+			//Only re-encode when the info or the steam id changed since the last reply from this worker
+			auto& cache = worker.m_InfoCache;
+			auto& info = GetServerInfoHolder();
+			uint64_t steamID = m_ServerSteamID;
+			if (!cache.IsValid(info.GetVersion(), steamID))
+				cache.Rebuild(*info.Load(), steamID, m_ArgParser.GetOptionValueString("-version"), m_ArgParser.GetOptionValueInt16U("-port"));
+
+			//The info didn't fit into a reply, better no answer than an empty datagram
+			if (!cache.GetLength())
+				return false;
+
+			reply.WriteBytes(cache.GetData(), static_cast<int>(cache.GetLength()));
+			return true;
+		}
+		case A2S_PLAYER:
+		{
+			if (CONFIG_HANDLE_QUERY_BY_STEAM)
+				return false;
+
+			if (!CheckQueryChallenge(msg, reply, remote_endpoint))
+				return true;
+
+			auto& cache = worker.m_PlayerCache;
+			auto& info = GetServerInfoHolder();
+			if (!cache.IsValid(info.GetVersion(), info.GetA2sPlayerVersion()))
+				cache.Rebuild(*info.Load());
+
+			auto& packets = cache.GetPackets();
+			if (packets.GetNumPackets() == 1)
+				reply.WriteBytes(packets.GetPacket(0), static_cast<int>(packets.GetPacketLength(0)));
+			else
+			{
+				worker.m_pSplitReply = &packets;
+				worker.m_NumSplitSent = 0;
+			}
+
+			return true;
+		}
+		case A2S_GETCHALLENGE:
+		{
+			if (!m_HasLogonResult)
+				break;
+
+			char temp[512];
+			msg.ReadString(temp, sizeof(temp));
+
+			//tiny csgo client wants to authenticate ticket
+			if (strcmp(temp, "tiny-csgo-client") == 0)
+			{
+				//Auth sessions are steam calls, leave them to the main thread
+				if (!worker.m_IsMain)
+					return false;
+
+				auto keyLen = msg.ReadShort();
+				msg.ReadBytes(temp, keyLen);
+
+				uint64_t userSteamID = *reinterpret_cast<uint64_t*>((uintptr_t)temp + 12);
+				S2cTicketResult::Write(reply, BeginAuthSession(temp, keyLen, userSteamID) ? S2C_CONNECTION : S2C_CONNREJECT);
+			}
+			else
+			{
+				//We reject the client here so we won't get reject from lobby error.
+				if (m_ArgParser.HasOption("-rdip"))
+				{
+					S2cConnRedirect::Write(reply, m_ArgParser.GetOptionValueString("-rdip"));
+				}
+				else
+				{
+					auto info = GetServerInfoHolder().Load();
+					auto challenge = m_Challenge.Generate(remote_endpoint.address().to_v4().to_uint(), remote_endpoint.port());
+
+					snprintf(temp, sizeof(temp), "connect0x%X", challenge);
+					S2cConnectChallenge::Write(reply, challenge, m_ServerSteamID, temp, m_VersionInt,
+						info->ServerPasswordNeeded() ? "friends" : "public", info->ServerPasswordNeeded(), info->ServerIsOfficial());
+				}
+			}
+			
+			return true;
+		}
+		case C2S_CONNECT:
+		{
+			//We don't want clients to connect to our server, so reject every connection request
+			if (m_ArgParser.HasOption("-rdip"))
+				S2cConnRedirect::Write(reply, m_ArgParser.GetOptionValueString("-rdip"));
+			else
+				S2cConnReject::Write(reply, "This server will reject every connection request, don't attempt to connect.");
+
+			return true;
+		}
+		default:
+			return false;
+		}// switch (c)
+
+		return false;
+	}
+
+private:
+	//Formatting happens on the log thread, this only copies the numbers
+	void LogPacket(ServerWorker& worker, uint32_t ip, uint16_t port, size_t length)
+	{
+		if (!g_LogRing.IsEnabled(LogLevel::Debug) || !worker.m_PacketLogSampler.Sample(CONFIG_LOG_PACKET_SAMPLE_RATE))
+			return;
+
+		g_LogRing.Write(LogLevel::Debug, "Receive messages from %u.%u.%u.%u:%d, size %d\n",
+			ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, static_cast<int>(port), static_cast<int>(length));
+	}
+
+	//Runs before anything is parsed, false if the source has used up its budget for this kind of packet
+	bool AllowPacket(ServerWorker& worker, const char* pData, size_t length, uint32_t ip)
+	{
+		//Every client datagram passes here exactly once, whatever the transport
+		CountPacket();
+
+		if (!worker.m_pLimiter)
+			return true;
+
+		return worker.m_pLimiter->Allow(ip, ClassifyPacket(pData, length), RateLimiter::NowMs());
+	}
+
+	//True if the query carries the challenge of its sender, otherwise reply is set to hand out the challenge
+	bool CheckQueryChallenge(bf_read& msg, bf_write& reply, const udp::endpoint& remote_endpoint)
+	{
+		if (!CONFIG_A2S_CHALLENGE_REQUIRED)
+			return true;
+
+		auto ip = remote_endpoint.address().to_v4().to_uint();
+		auto port = remote_endpoint.port();
+		if (msg.GetNumBytesLeft() >= 4 && m_Challenge.Validate(msg.ReadLong(), ip, port))
+			return true;
+
+		S2cQueryChallenge::Write(reply, m_Challenge.Generate(ip, port));
+		return false;
+	}
+
+	inline NetIoMode GetNetIoModeFromString(const char* mode)
+	{
+#ifdef __linux__
+		if (!strcmp(mode, "mmsg"))
+			return NetIoMode::Mmsg;
+#endif
+#ifdef TINY_CSGO_HAS_IO_URING
+		if (!strcmp(mode, "uring"))
+			return NetIoMode::Uring;
+#endif
+		if (strcmp(mode, "asio"))
+			printf("Network io mode \"%s\" is not available, falling back to asio\n", mode);
+
+		return NetIoMode::Asio;
+	}
+
+	inline LogLevel GetLogLevelFromString(const char* level)
+	{
+		if (!strcmp(level, "debug"))
+			return LogLevel::Debug;
+		if (!strcmp(level, "warning"))
+			return LogLevel::Warning;
+		if (!strcmp(level, "error"))
+			return LogLevel::Error;
+		if (strcmp(level, "info"))
+			printf("Unknown log level \"%s\", using info\n", level);
+
+		return LogLevel::Info;
+	}
+
+	inline uint32_t GetIntVersionFromString(const char* version)
+	{
+		char temp[64];
+		int source_idx = 0;
+		int dest_idx = 0;
+
+		for (; ; ++source_idx)
+		{
+			if (version[source_idx] == '.')
+				continue;
+
+			temp[dest_idx++] = version[source_idx];
+
+			if (version[source_idx + 1] == 0)
+			{
+				temp[dest_idx] = 0;
+				break;
+			}
+		}
+
+		return atoi(temp);
+	}
+
+protected:
+	ArgParser&	m_ArgParser;
+
+	//Written by the main thread every frame, read by every query worker.
+	//Workers never call into steam, the logon flag is copied here from the steam callback's state.
+	std::atomic<uint64_t>	m_ServerSteamID = 0;
+	std::atomic<bool>		m_HasLogonResult = false;
+
+private:
+	uint32_t	m_VersionInt = 0;
+	uint32_t	m_NumWorkers = 1;
+	NetIoMode	m_NetIoMode = NetIoMode::Asio;
+
+	//Key is fixed after construction, shared by every worker without locking
+	ChallengeCookie			m_Challenge;
+
+	ServerWorker*									m_pMainWorker = nullptr;
+	std::unique_ptr<ServerWorker>					m_pForwardWorker;
+	std::vector<std::unique_ptr<asio::io_context>>	m_WorkerContexts;
+	std::vector<std::unique_ptr<udp::socket>>		m_WorkerSockets;
+	std::vector<std::unique_ptr<ServerWorker>>		m_Workers;
+	std::vector<std::thread>						m_WorkerThreads;
+
+	//Ring of m_ForwardCount datagrams starting at m_ForwardHead, all guarded by m_ForwardLock
+	std::mutex							m_ForwardLock;
+	std::unique_ptr<ForwardedPacket[]>	m_pForwardQueue;
+	size_t								m_ForwardHead = 0;
+	size_t								m_ForwardCount = 0;
+	uint64_t							m_ForwardDropped = 0;
+	bool								m_ForwardDraining = false;
+
+	//Memory of the queued DrainHandler, taken by a worker and given back on the main thread.
+	//Both sides pass m_ForwardLock in between.
+	HandlerSlot							m_DrainHandlerSlot;
+
+	MirrorCluster	m_Mirror{ g_IoContext };
+};
+
+#endif // !__TINY_CSGO_SERVER_QUERYSERVER_HPP__
@@ -0,0 +1,184 @@
+#ifndef __TINY_CSGO_SERVER_RATELIMIT_HPP__
+#define __TINY_CSGO_SERVER_RATELIMIT_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Per source token buckets. Sources live in a fixed open-addressed table, a lookup probes a
+// short window of cache-line aligned slots and when the source isn't there the clock hand
+// of that window picks a slot that hasn't been hit since it last passed. A flood of spoofed
+// sources only recycles slots, the table never grows.
+//
+// The window of a source is picked by a hash keyed with a secret derived from the challenge
+// key, so nobody can pick addresses that land in the window of somebody else to evict them.
+// A new or evicted source starts with one second of tokens instead of a full bucket, getting
+// evicted on purpose doesn't refill a bucket either.
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include "challenge.hpp"
+#include "common/info_const.hpp"
+#include "common/proto_oob.h"
+
+enum class PacketClass : uint8_t
+{
+	Query,		//A2S queries and everything else we hand to steam
+	Challenge,	//A2S_GETCHALLENGE
+	Connect,	//C2S_CONNECT
+	Count
+};
+
+struct RateLimitRule
+{
+	uint32_t	m_Rate;		//Tokens per second
+	uint32_t	m_Burst;	//Bucket size
+};
+
+inline constexpr RateLimitRule RATELIMIT_RULES[static_cast<size_t>(PacketClass::Count)] = {
+	{ CONFIG_RATELIMIT_QUERY_RATE, CONFIG_RATELIMIT_QUERY_BURST },
+	{ CONFIG_RATELIMIT_CHALLENGE_RATE, CONFIG_RATELIMIT_CHALLENGE_BURST },
+	{ CONFIG_RATELIMIT_CONNECT_RATE, CONFIG_RATELIMIT_CONNECT_BURST },
+};
+
+//Only looks at the header and type byte, this runs before anything is parsed
+inline PacketClass ClassifyPacket(const char* pData, size_t length)
+{
+	int32_t header = 0;
+	if (length >= 5)
+		memcpy(&header, pData, sizeof(header));
+
+	if (header != CONNECTIONLESS_HEADER)
+		return PacketClass::Query;
+
+	switch (pData[4])
+	{
+	case A2S_GETCHALLENGE:
+		return PacketClass::Challenge;
+	case C2S_CONNECT:
+		return PacketClass::Connect;
+	default:
+		return PacketClass::Query;
+	}
+}
+
+class RateLimiter
+{
+public:
+	RateLimiter(const ChallengeCookie& cookie) :
+		m_pWindows(std::make_unique<Window[]>(NUM_WINDOWS)),
+		m_HashMultiplier(cookie.DeriveKey(1) | 1),
+		m_HashIncrement(cookie.DeriveKey(2))
+	{
+	}
+
+	static uint32_t NowMs()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+	}
+
+	//ip in host byte order. Takes a token from the source's bucket for this class, false if it's empty.
+	bool Allow(uint32_t ip, PacketClass cls, uint32_t nowMs)
+	{
+		auto& slot = FindSlot(ip, nowMs);
+		slot.m_Referenced = true;
+
+		//Refill every class at once, tokens are kept in thousandths so a rate per second times milliseconds is exact
+		auto elapsed = nowMs - slot.m_LastMs;
+		if (elapsed)
+		{
+			slot.m_LastMs = nowMs;
+			for (size_t i = 0; i < static_cast<size_t>(PacketClass::Count); ++i)
+			{
+				auto max = RATELIMIT_RULES[i].m_Burst * 1000;
+				auto refill = static_cast<uint64_t>(elapsed) * RATELIMIT_RULES[i].m_Rate;
+				slot.m_Tokens[i] = refill >= max - slot.m_Tokens[i] ? max : slot.m_Tokens[i] + static_cast<uint32_t>(refill);
+			}
+		}
+
+		auto& tokens = slot.m_Tokens[static_cast<size_t>(cls)];
+		if (tokens < 1000)
+			return false;
+
+		tokens -= 1000;
+		return true;
+	}
+
+private:
+	struct alignas(32) Slot
+	{
+		uint32_t	m_Ip;
+		uint32_t	m_LastMs;
+		uint32_t	m_Tokens[static_cast<size_t>(PacketClass::Count)];
+		bool		m_Used;
+		bool		m_Referenced;
+		uint8_t		m_Hand;		//Clock hand of the window, only kept in its first slot
+	};
+
+	//A probe window, two slots per cache line
+	struct alignas(64) Window
+	{
+		Slot	m_Slots[CONFIG_RATELIMIT_PROBE];
+	};
+
+	static_assert((CONFIG_RATELIMIT_TABLE_SIZE & (CONFIG_RATELIMIT_TABLE_SIZE - 1)) == 0, "Rate limit table size has to be a power of 2");
+	static_assert((CONFIG_RATELIMIT_PROBE & (CONFIG_RATELIMIT_PROBE - 1)) == 0, "Rate limit probe window has to be a power of 2");
+	static_assert(CONFIG_RATELIMIT_TABLE_SIZE > CONFIG_RATELIMIT_PROBE, "Rate limit table needs more than one window");
+
+	static constexpr size_t NUM_WINDOWS = CONFIG_RATELIMIT_TABLE_SIZE / CONFIG_RATELIMIT_PROBE;
+	static constexpr int WINDOW_BITS = std::bit_width(NUM_WINDOWS) - 1;
+
+	Slot& FindSlot(uint32_t ip, uint32_t nowMs)
+	{
+		auto* window = m_pWindows[WindowIndex(ip)].m_Slots;
+		for (size_t i = 0; i < CONFIG_RATELIMIT_PROBE; ++i)
+		{
+			if (window[i].m_Used && window[i].m_Ip == ip)
+				return window[i];
+		}
+
+		//Clock sweep over the window, referenced slots get a second chance.
+		//After one full turn every reference bit is clear, so this always ends.
+		auto& hand = window[0].m_Hand;
+		Slot* victim = nullptr;
+		while (!victim)
+		{
+			auto& slot = window[hand];
+			hand = (hand + 1) & (CONFIG_RATELIMIT_PROBE - 1);
+
+			if (!slot.m_Used || !slot.m_Referenced)
+				victim = &slot;
+			else
+				slot.m_Referenced = false;
+		}
+
+		//A new source gets one second of tokens, enough for a client to ask for the challenge and
+		//query, but coming back after an eviction is no faster than waiting for the refill
+		victim->m_Ip = ip;
+		victim->m_LastMs = nowMs;
+		victim->m_Used = true;
+		victim->m_Referenced = false;
+		for (size_t i = 0; i < static_cast<size_t>(PacketClass::Count); ++i)
+			victim->m_Tokens[i] = std::min(RATELIMIT_RULES[i].m_Rate, RATELIMIT_RULES[i].m_Burst) * 1000;
+
+		return *victim;
+	}
+
+	//Multiply-add-shift with secret odd multiplier and increment, the top bits pick the window.
+	//Which addresses share a window depends on the secret, so collisions can't be planned.
+	size_t WindowIndex(uint32_t ip) const
+	{
+		return static_cast<size_t>((ip * m_HashMultiplier + m_HashIncrement) >> (64 - WINDOW_BITS));
+	}
+
+private:
+	std::unique_ptr<Window[]>	m_pWindows;
+	uint64_t					m_HashMultiplier;
+	uint64_t					m_HashIncrement;
+};
+
+#endif // !__TINY_CSGO_SERVER_RATELIMIT_HPP__
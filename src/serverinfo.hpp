@@ -1,56 +1,178 @@
 #ifndef __TINY_CSGO_SERVER_SERVERINFO_HPP__
 #define __TINY_CSGO_SERVER_SERVERINFO_HPP__
 
-#include <string>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <atomic>
+#include <memory>
 #include "common/info_const.hpp"
+#include "playertable.hpp"
 
-class ServerInfoHolder
+// Strings of a record in one buffer, each one null terminated and found by offset and length.
+// Setting one moves the ones behind it in place, so a record is never allocated from and copying
+// it is a single copy. A value that doesn't fit into what's left is cut short.
+
+template<size_t Count, size_t Size>
+class FlatStrings
 {
+	static_assert(Size >= Count && Size <= 0xFFFF, "Offsets and lengths are 16 bits");
+
 public:
-	std::string& ServerName() { return m_ServerName; }
-	std::string& ServerMap() { return m_ServerMap; }
-	std::string& ServerGameFolder() { return m_ServerGameFolder; }
-	std::string& ServerDescription() { return m_ServerDescription; }
-	constexpr uint16_t ServerAppID() { return SERVER_APPID; }
-	const uint8_t ServerNumClients() { return m_ServerMaxClients - 1; }
-	uint8_t& ServerMaxClients() { return m_ServerMaxClients; }
-	uint8_t& ServerNumFakeClient() { return m_ServerNumFakeClients; }
-	uint8_t& ServerType() { return m_ServerType; }
-	uint8_t& ServerOS() { return m_ServerOS; }
-	uint8_t& ServerProtocol() { return m_ServerProtocol; }
-	bool& ServerPasswordNeeded() { return m_ServerPasswdNeeded; }
-	bool& ServerVacStatus() { return m_ServerVacStatus; }
-	bool& ServerIsOfficial() { return m_ServerIsOfficial; }
-	std::string& ServerTag() { return m_ServerTag; }
-
-	void SaveA2sPlayerResponse(const char* pData, size_t length)
+	FlatStrings()
 	{
-		if (length > sizeof(m_A2sPlayerResponse))
+		//Every string starts out empty, just its terminator
+		for (size_t i = 0; i < Count; ++i)
 		{
-			printf("The size of the A2S_PLAYER response %d is too large\n", length);
-			return;
+			m_Offset[i] = static_cast<uint16_t>(i);
+			m_Data[i] = 0;
 		}
+	}
+
+	std::string_view Get(size_t i) const { return std::string_view(m_Data + m_Offset[i], m_Length[i]); }
+	const char* GetString(size_t i) const { return m_Data + m_Offset[i]; }
+
+	//The part of value that Set would store at i, the rest doesn't fit
+	std::string_view Fit(size_t i, std::string_view value) const
+	{
+		//Room for this string's characters, its terminator is already counted in m_Used
+		size_t room = Size - m_Used + m_Length[i];
+		return value.size() > room ? value.substr(0, room) : value;
+	}
+
+	void Set(size_t i, std::string_view value)
+	{
+		value = Fit(i, value);
+		size_t length = m_Length[i];
+
+		//Strings are stored in index order, the ones behind this one move by the difference
+		size_t tail = m_Offset[i] + length + 1;
+		ptrdiff_t delta = static_cast<ptrdiff_t>(value.size()) - static_cast<ptrdiff_t>(length);
+		memmove(m_Data + tail + delta, m_Data + tail, m_Used - tail);
+		memcpy(m_Data + m_Offset[i], value.data(), value.size());
+		m_Data[m_Offset[i] + value.size()] = 0;
+
+		for (size_t j = i + 1; j < Count; ++j)
+			m_Offset[j] = static_cast<uint16_t>(m_Offset[j] + delta);
+
+		m_Length[i] = static_cast<uint16_t>(value.size());
+		m_Used = static_cast<uint16_t>(m_Used + delta);
+	}
+
+private:
+	uint16_t	m_Offset[Count];
+	uint16_t	m_Length[Count] = {};
+	uint16_t	m_Used = Count;
+	char		m_Data[Size];
+};
+
+// The server info and the mirrored player list as one value. A published ServerInfo is never
+// changed again. Updating means copying the current one, changing the copy and publishing it,
+// so a reader always sees the info and the players of one update, without taking a lock.
+
+class ServerInfo
+{
+public:
+	ServerInfo()
+	{
+		m_Strings.Set(Name, SERVER_NAME);
+		m_Strings.Set(Map, SERVER_MAP);
+		m_Strings.Set(GameFolder, SERVER_GAME_FOLDER);
+		m_Strings.Set(Description, SERVER_DESCRIPTION);
+		m_Strings.Set(Tag, SERVER_TAG);
+	}
+
+	//Null terminated, straight out of the record, for the reply encoder and the steam calls alike
+	const char* ServerName() const { return m_Strings.GetString(Name); }
+	const char* ServerMap() const { return m_Strings.GetString(Map); }
+	const char* ServerGameFolder() const { return m_Strings.GetString(GameFolder); }
+	const char* ServerDescription() const { return m_Strings.GetString(Description); }
+	constexpr uint16_t ServerAppID() const { return SERVER_APPID; }
+	//One short of full until a mirror tells the real number
+	uint8_t ServerNumClients() const { return m_ServerNumClientsMirrored ? m_ServerNumClients : m_ServerMaxClients - 1; }
+	uint8_t ServerMaxClients() const { return m_ServerMaxClients; }
+	uint8_t ServerNumFakeClient() const { return m_ServerNumFakeClients; }
+	uint8_t ServerType() const { return m_ServerType; }
+	uint8_t ServerOS() const { return m_ServerOS; }
+	uint8_t ServerProtocol() const { return m_ServerProtocol; }
+	bool ServerPasswordNeeded() const { return m_ServerPasswdNeeded; }
+	bool ServerVacStatus() const { return m_ServerVacStatus; }
+	bool ServerIsOfficial() const { return m_ServerIsOfficial; }
+	const char* ServerTag() const { return m_Strings.GetString(Tag); }
+
+	//Setters only bump the version when the value really changes, so the encoded replies survive identical updates
+	void SetServerName(std::string_view name) { UpdateString(Name, name); }
+	void SetServerMap(std::string_view map) { UpdateString(Map, map); }
+	void SetServerGameFolder(std::string_view folder) { UpdateString(GameFolder, folder); }
+	void SetServerNumClients(uint8_t numClients) { UpdateField(m_ServerNumClients, numClients); UpdateField(m_ServerNumClientsMirrored, true); }
+	void SetServerMaxClients(uint8_t maxClients) { UpdateField(m_ServerMaxClients, maxClients); }
+	void SetServerNumFakeClient(uint8_t numFakeClients) { UpdateField(m_ServerNumFakeClients, numFakeClients); }
+	void SetServerType(uint8_t type) { UpdateField(m_ServerType, type); }
+	void SetServerOS(uint8_t os) { UpdateField(m_ServerOS, os); }
+	void SetServerProtocol(uint8_t protocol) { UpdateField(m_ServerProtocol, protocol); }
+	void SetServerPasswordNeeded(bool needed) { UpdateField(m_ServerPasswdNeeded, needed); }
+	void SetServerVacStatus(bool vac) { UpdateField(m_ServerVacStatus, vac); }
+	void SetServerTag(std::string_view tag) { UpdateString(Tag, tag); }
+
+	//Changes whenever one of the fields above changes
+	uint32_t GetVersion() const { return m_Version; }
+
+	void SavePlayers(const PlayerTable& players)
+	{
+		if (m_pPlayers && *m_pPlayers == players)
+			return;
+
+		//The table is shared by every snapshot until it changes, copying the info doesn't copy it
+		m_pPlayers = std::make_shared<const PlayerTable>(players);
+		++m_A2sPlayerVersion;
+	}
 
-		memcpy(m_A2sPlayerResponse, pData, length);
-		m_A2sPlayerResponseLength = length;
+	//Back to the default reply
+	void ClearPlayers()
+	{
+		if (!m_pPlayers)
+			return;
+
+		m_pPlayers.reset();
+		++m_A2sPlayerVersion;
 	}
 
-	char* GetA2sPlayerResponse()
+	//Null until a mirror saves a list, the default reply goes out then
+	const PlayerTable* GetPlayers() const { return m_pPlayers.get(); }
+
+	//Changes whenever the mirrored player list changes
+	uint32_t GetA2sPlayerVersion() const { return m_A2sPlayerVersion; }
+
+private:
+	template<typename T, typename V>
+	void UpdateField(T& field, const V& value)
 	{
-		return m_A2sPlayerResponse;
+		if (field == value)
+			return;
+
+		field = value;
+		++m_Version;
 	}
 
-	size_t GetA2sPlayerResponseLength()
+	//Compared as it would be stored, a string cut short stays the same on every update
+	void UpdateString(size_t i, std::string_view value)
 	{
-		return m_A2sPlayerResponseLength;
+		value = m_Strings.Fit(i, value);
+		if (m_Strings.Get(i) == value)
+			return;
+
+		m_Strings.Set(i, value);
+		++m_Version;
 	}
 
 private:
-	std::string		m_ServerName			= SERVER_NAME;
-	std::string		m_ServerMap				= SERVER_MAP;
-	std::string		m_ServerGameFolder		= SERVER_GAME_FOLDER;
-	std::string		m_ServerDescription		= SERVER_DESCRIPTION;
+	enum StringIndex : size_t { Name, Map, GameFolder, Description, Tag, NumStrings };
+
+	//Every string of a S2A_INFO_SRC fits, the whole reply has to fit into one datagram
+	FlatStrings<NumStrings, 1024>	m_Strings;
+
 	uint8_t			m_ServerNumClients		= SERVER_NUM_CLIENTS;
+	bool			m_ServerNumClientsMirrored	= false;
 	uint8_t			m_ServerMaxClients		= SERVER_MAX_CLIENTS;
 	uint8_t			m_ServerNumFakeClients	= SERVER_NUM_FAKE_CLIENTS;
 	uint8_t			m_ServerType			= SERVER_TYPE;
@@ -59,10 +181,53 @@ private:
 	bool			m_ServerPasswdNeeded	= SERVER_PASSWD_NEEDED;
 	bool			m_ServerVacStatus		= SERVER_VAC_STATES;
 	bool			m_ServerIsOfficial		= SERVER_VALVE_OFFICIAL;
-	std::string		m_ServerTag				= SERVER_TAG;
 
-	char	m_A2sPlayerResponse[20480];
-	size_t	m_A2sPlayerResponseLength = 0;
+	std::shared_ptr<const PlayerTable>	m_pPlayers;
+
+	uint32_t	m_Version = 1;
+	uint32_t	m_A2sPlayerVersion = 1;
+};
+
+// Hands out the current ServerInfo. Query workers load it from their own threads while the
+// mirror publishes new ones on the main thread, a loaded snapshot stays valid as long as it's held.
+// libstdc++ guards std::atomic<std::shared_ptr> with a short lock, so queries only read the
+// version numbers and load the snapshot when a cache has to be rebuilt.
+
+class ServerInfoHolder
+{
+public:
+	ServerInfoHolder() :
+		m_pInfo(std::make_shared<const ServerInfo>())
+	{
+	}
+
+	std::shared_ptr<const ServerInfo> Load() const { return m_pInfo.load(std::memory_order_acquire); }
+
+	//Versions of the current snapshot, for checking a cache without loading it
+	uint32_t GetVersion() const { return m_Version.load(std::memory_order_acquire); }
+	uint32_t GetA2sPlayerVersion() const { return m_A2sPlayerVersion.load(std::memory_order_acquire); }
+
+	//Only one thread publishes, the copy has to be made from the current snapshot.
+	//A copy without changes isn't published, so readers keep their caches.
+	void Publish(ServerInfo&& info)
+	{
+		auto current = Load();
+		if (info.GetVersion() == current->GetVersion() && info.GetA2sPlayerVersion() == current->GetA2sPlayerVersion())
+			return;
+
+		auto version = info.GetVersion();
+		auto playerVersion = info.GetA2sPlayerVersion();
+
+		//Versions go out after the snapshot, whoever sees them loads this one or a newer one
+		m_pInfo.store(std::make_shared<const ServerInfo>(std::move(info)), std::memory_order_release);
+		m_Version.store(version, std::memory_order_release);
+		m_A2sPlayerVersion.store(playerVersion, std::memory_order_release);
+	}
+
+private:
+	std::atomic<std::shared_ptr<const ServerInfo>>	m_pInfo;
+	std::atomic<uint32_t>							m_Version = 1;
+	std::atomic<uint32_t>							m_A2sPlayerVersion = 1;
 };
 
 static inline ServerInfoHolder s_ServerInfoHolder;
@@ -73,4 +238,3 @@ inline ServerInfoHolder& GetServerInfoHolder()
 }
 
 #endif // !__TINY_CSGO_SERVER_SERVERINFO_HPP__
-
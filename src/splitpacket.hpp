@@ -0,0 +1,86 @@
+#ifndef __TINY_CSGO_SERVER_SPLITPACKET_HPP__
+#define __TINY_CSGO_SERVER_SPLITPACKET_HPP__
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Source engine split packets. A connectionless reply too large for one routable datagram
+// is cut into pieces, every piece carries
+//   long  NET_HEADER_FLAG_SPLITPACKET
+//   long  packet id
+//   byte  total number of packets
+//   byte  number of this packet
+//   short max size of a piece
+// followed by up to NET_SPLIT_PAYLOAD_SIZE bytes of the original reply.
+
+#include <cstring>
+#include "bitbuf/bitbuf.h"
+#include "common/info_const.hpp"
+#include "logring.hpp"
+#include "packetschema.hpp"
+
+class SplitPacketSet
+{
+public:
+	//Cut pPayload into datagrams, a payload that fits into one datagram is kept as is
+	bool Build(const char* pPayload, size_t length, uint32_t packetId)
+	{
+		m_NumPackets = 0;
+		m_Used = 0;
+
+		if (length <= NET_MAX_ROUTABLE_PAYLOAD)
+		{
+			AddPacket(pPayload, length, nullptr, 0);
+			return true;
+		}
+
+		if (length > MAX_SPLIT_REPLY_SIZE)
+		{
+			g_LogRing.Write(LogLevel::Warning, "Reply of %d bytes is too large to be split\n", static_cast<int>(length));
+			return false;
+		}
+
+		auto numPackets = (length + NET_SPLIT_PAYLOAD_SIZE - 1) / NET_SPLIT_PAYLOAD_SIZE;
+
+		for (size_t i = 0; i < numPackets; ++i)
+		{
+			char header[NET_SPLIT_HEADER_SIZE];
+			bf_write buf(header, sizeof(header));
+			SplitPacketHeader::Write(buf, packetId, numPackets, i);
+
+			auto offset = i * NET_SPLIT_PAYLOAD_SIZE;
+			auto size = length - offset < NET_SPLIT_PAYLOAD_SIZE ? length - offset : NET_SPLIT_PAYLOAD_SIZE;
+			AddPacket(pPayload + offset, size, header, sizeof(header));
+		}
+
+		return true;
+	}
+
+	int			GetNumPackets() const { return m_NumPackets; }
+	const char*	GetPacket(int index) const { return m_Data + m_Offsets[index]; }
+	size_t		GetPacketLength(int index) const { return m_Lengths[index]; }
+
+private:
+	void AddPacket(const char* pPayload, size_t length, const char* pHeader, size_t headerLength)
+	{
+		m_Offsets[m_NumPackets] = m_Used;
+		m_Lengths[m_NumPackets] = headerLength + length;
+
+		if (headerLength)
+			memcpy(m_Data + m_Used, pHeader, headerLength);
+
+		memcpy(m_Data + m_Used + headerLength, pPayload, length);
+		m_Used += headerLength + length;
+		++m_NumPackets;
+	}
+
+private:
+	char	m_Data[MAX_SPLIT_REPLY_SIZE + NET_MAX_SPLIT_PACKETS * NET_SPLIT_HEADER_SIZE];
+	size_t	m_Offsets[NET_MAX_SPLIT_PACKETS];
+	size_t	m_Lengths[NET_MAX_SPLIT_PACKETS];
+	size_t	m_Used = 0;
+	int		m_NumPackets = 0;
+};
+
+#endif // !__TINY_CSGO_SERVER_SPLITPACKET_HPP__
@@ -13,6 +13,7 @@
 #include <steam_api.h>
 #include <steam_gameserver.h>
 #include "common/info_const.hpp"
+#include "logring.hpp"
 
 using namespace std::chrono_literals;
 
@@ -137,7 +138,7 @@ inline CSteam3Server& Steam3Server()
 
 inline void CSteam3Server::OnValidateAuthTicketResponse(ValidateAuthTicketResponse_t* pValidateAuthTicketResponse)
 {
-	printf("GC response the result of validation of the ticket [SteamID: %llu]\n", pValidateAuthTicketResponse->m_SteamID.ConvertToUint64());
+	g_LogRing.Write(LogLevel::Info, "GC response the result of validation of the ticket [SteamID: %llu]\n", static_cast<unsigned long long>(pValidateAuthTicketResponse->m_SteamID.ConvertToUint64()));
 	GetAuthHolder().SetAuth(pValidateAuthTicketResponse->m_SteamID.ConvertToUint64(), pValidateAuthTicketResponse->m_eAuthSessionResponse);
 	const char* reason = nullptr;
 
@@ -178,7 +179,7 @@ inline void CSteam3Server::OnValidateAuthTicketResponse(ValidateAuthTicketRespon
 		break;
 	}
 
-	printf("Auth response: %d(%s)\n", pValidateAuthTicketResponse->m_eAuthSessionResponse, reason);
+	g_LogRing.Write(LogLevel::Info, "Auth response: %d(%s)\n", static_cast<int>(pValidateAuthTicketResponse->m_eAuthSessionResponse), reason);
 }
 
 inline void CSteam3Server::OnGSPolicyResponse(GSPolicyResponse_t* pPolicyResponse)
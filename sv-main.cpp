@@ -2,6 +2,28 @@
 #include "GCClient.hpp"
 #include "server.hpp"
 
+#ifdef TINY_CSGO_COUNT_ALLOCATIONS
+void* operator new(size_t size)
+{
+	g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto* p = malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+//Kept out of line so the compiler doesn't pair a new inlined somewhere with the free in here
+NOINLINE void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	ArgParser parser;
@@ -12,6 +34,14 @@ int main(int argc, char** argv)
 	parser.AddOption("-rdip", "Redirect IP address (e.g. 127.0.0.1:27015)", OptionAttr::OptionalWithValue, OptionValueType::STRING);
 	parser.AddOption("-vac", "Enable VAC?", OptionAttr::OptionalWithoutValue, OptionValueType::NONE);
 	parser.AddOption("-mirror", "Enable mirroring server info from redrecting server?", OptionAttr::OptionalWithoutValue, OptionValueType::NONE);
+	parser.AddOption("-upstream", "Servers to mirror, comma separated (e.g. 127.0.0.1:27016,127.0.0.1:27017), -rdip if not set", OptionAttr::OptionalWithValue, OptionValueType::STRING);
+#ifdef __linux__
+	parser.AddOption("-netio", "Network io mode, asio, mmsg (recvmmsg/sendmmsg batches) or uring (io_uring)", OptionAttr::OptionalWithValue, OptionValueType::STRING, "asio");
+#else
+	parser.AddOption("-netio", "Network io mode, only asio is available on this platform", OptionAttr::OptionalWithValue, OptionValueType::STRING, "asio");
+#endif
+	parser.AddOption("-threads", "Number of query worker threads sharing the port", OptionAttr::OptionalWithValue, OptionValueType::INT8U, "1", 1);
+	parser.AddOption("-loglevel", "Lowest level that is logged, debug, info, warning or error", OptionAttr::OptionalWithValue, OptionValueType::STRING, "info");
 
 
 	try
@@ -24,9 +54,17 @@ int main(int argc, char** argv)
 		return -1;
 	}
 
-	if (parser.HasOption("-mirror") && !parser.HasOption("-rdip"))
+	auto* version = parser.GetOptionValueString("-version");
+	auto versionLength = strlen(version);
+	if (!versionLength || versionLength > MAX_VERSION_LENGTH || strspn(version, "0123456789.") != versionLength)
+	{
+		printf("-version has to be a version number like 1.38.5.5, at most %d characters\n", static_cast<int>(MAX_VERSION_LENGTH));
+		return -1;
+	}
+
+	if (parser.HasOption("-mirror") && !parser.HasOption("-rdip") && !parser.HasOption("-upstream"))
 	{
-		printf("When -mirror is enabled, you have to provide a redirect server socket by option -rdip\n");
+		printf("When -mirror is enabled, you have to provide the servers to mirror by option -upstream or -rdip\n");
 		return -1;
 	}
 
@@ -0,0 +1,494 @@
+//Checks of the server components built on top of bitbuf: the player table, the server info
+//strings, the heap allocations of a running server and the mirror's poll timeout. Exits with an
+//error if any of them fails.
+
+#ifndef TINY_CSGO_COUNT_ALLOCATIONS
+#define TINY_CSGO_COUNT_ALLOCATIONS
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "bitbuf/bitbuf.h"
+#include "allocstats.hpp"
+#include "mirror.hpp"
+#include "packetschema.hpp"
+#include "playertable.hpp"
+#include "queryserver.hpp"
+
+//Counted like in sv-main.cpp, the query check looks at the difference. Kept out of line so the
+//compiler doesn't pair a new inlined somewhere with the free in here.
+void* operator new(size_t size)
+{
+	g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto* p = malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+NOINLINE void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+NOINLINE void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static const char* const PLAYER_NAMES[] = {
+	"Counter-Strike: Global Offensive",
+	"de_dust2",
+	"csgo",
+	"empty,secure",
+	"",
+	"A somewhat longer server name that is still well within the limits of A2S_INFO",
+};
+
+//Only the bits up to the cursor count, the bit packing may leave junk behind it
+static bool SameBits(const bf_write& a, const bf_write& b)
+{
+	int nBits = a.GetNumBitsWritten();
+	if (nBits != b.GetNumBitsWritten())
+		return false;
+
+	if (memcmp(a.GetData(), b.GetData(), nBits >> 3) != 0)
+		return false;
+
+	int mask = (1 << (nBits & 7)) - 1;
+	return (nBits & 7) == 0 || ((a.GetData()[nBits >> 3] ^ b.GetData()[nBits >> 3]) & mask) == 0;
+}
+
+//Players for the player table check, every third one with an empty name like a connecting client
+static void WritePlayerRecords(bf_write& buf, int count, float playedFor)
+{
+	constexpr int numNames = sizeof(PLAYER_NAMES) / sizeof(PLAYER_NAMES[0]);
+
+	buf.WriteByte(count);
+	for (int i = 0; i < count; ++i)
+		S2aPlayerRecord::Write(buf, static_cast<uint8>(i), i % 3 ? PLAYER_NAMES[i % numNames] : "", i * 7 - 20, playedFor + i * 1.5f);
+}
+
+static bool CheckPlayerTable()
+{
+	char records[4096];
+	bf_write recordsBuf(records, sizeof(records));
+	WritePlayerRecords(recordsBuf, 40, 0.0f);
+	if (recordsBuf.IsOverflowed())
+		return false;
+
+	PlayerTable table;
+	table.Decode(records, recordsBuf.GetNumBytesWritten());
+	if (table.Size() != 40 || table.EncodedSize() != static_cast<size_t>(recordsBuf.GetNumBytesWritten()))
+		return false;
+
+	//Encoded again at every offset the table gives back the records it was decoded from
+	for (int startBit : { 0, 8, 3 })
+	{
+		char expected[4096], encoded[4096];
+		memset(expected, 0, sizeof(expected));
+		memset(encoded, 0, sizeof(encoded));
+		bf_write expectedBuf(expected, sizeof(expected));
+		bf_write encodedBuf(encoded, sizeof(encoded));
+		expectedBuf.SeekToBit(startBit);
+		encodedBuf.SeekToBit(startBit);
+		expectedBuf.WriteBytes(records, recordsBuf.GetNumBytesWritten());
+		if (!table.Encode(encodedBuf) || !SameBits(expectedBuf, encodedBuf))
+			return false;
+	}
+
+	//A list cut off in a record keeps the records before it
+	PlayerTable cut;
+	cut.Decode(records, recordsBuf.GetNumBytesWritten() - 3);
+	if (cut.Size() != 39 || cut.Name(38) != table.Name(38))
+		return false;
+
+	//Merged tables stop at the count byte's limit, durations don't count as a change
+	PlayerTable merged;
+	for (int i = 0; i < 8; ++i)
+		merged.Append(table);
+
+	char laterRecords[4096];
+	bf_write laterBuf(laterRecords, sizeof(laterRecords));
+	WritePlayerRecords(laterBuf, 40, 60.0f);
+
+	PlayerTable later;
+	later.Decode(laterRecords, laterBuf.GetNumBytesWritten());
+
+	return merged.Size() == PlayerTable::MAX_PLAYERS && merged.Name(40) == table.Name(0)
+		&& later.SamePlayers(table) && !(later == table);
+}
+
+//Setting the strings of the last merge again leaves the version alone, also when one of them is cut short
+static bool CheckServerInfoStrings()
+{
+	char longName[2000];
+	memset(longName, 'n', sizeof(longName));
+	std::string_view name(longName, sizeof(longName));
+
+	//Like a merge, the name first. A shorter map leaves more room for the name on the next round.
+	ServerInfo info;
+	auto merge = [&]
+	{
+		info.SetServerName(name);
+		info.SetServerMap("de_dust2");
+	};
+
+	merge();
+	merge();
+	auto version = info.GetVersion();
+
+	merge();
+	return info.GetVersion() == version && strlen(info.ServerName()) < sizeof(longName);
+}
+
+//Plays steam for the checks: A2A_PING is handed to it and answered with an A2A_ACK, like the
+//datagrams the real server leaves to steam
+class CheckServer : public QueryServer
+{
+public:
+	CheckServer(ArgParser& parser) :
+		QueryServer(parser)
+	{
+		//Connect challenges are only handed out once steam logged on
+		m_ServerSteamID = 90000000000000001ull;
+		m_HasLogonResult = true;
+	}
+
+protected:
+	bool HandleSteamPacket(const void* pData, int length, uint32_t ip, uint16_t port) override
+	{
+		if (length < 5 || static_cast<const char*>(pData)[4] != A2A_PING)
+			return false;
+
+		m_AckIp = ip;
+		m_AckPort = port;
+		m_HasAck = true;
+		return true;
+	}
+
+	int GetNextSteamPacket(void* pOut, int maxLength, uint32_t* pIp, uint16_t* pPort) override
+	{
+		if (!std::exchange(m_HasAck, false))
+			return 0;
+
+		bf_write buf(pOut, maxLength);
+		buf.WriteLong(CONNECTIONLESS_HEADER);
+		buf.WriteByte(A2A_ACK);
+
+		*pIp = m_AckIp;
+		*pPort = m_AckPort;
+		return buf.GetNumBytesWritten();
+	}
+
+	bool BeginAuthSession(const void*, int, uint64_t) override
+	{
+		return false;
+	}
+
+private:
+	uint32_t	m_AckIp = 0;
+	uint16_t	m_AckPort = 0;
+	bool		m_HasAck = false;
+};
+
+//Waits up to a second for the next datagram, 0 if none came
+static size_t ReceiveDatagram(udp::socket& socket, char* pBuf, size_t size)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (true)
+	{
+		asio::error_code ec;
+		auto length = socket.receive(asio::buffer(pBuf, size), 0, ec);
+		if (!ec)
+			return length;
+
+		if ((ec != asio::error::would_block && ec != asio::error::try_again) || std::chrono::steady_clock::now() > deadline)
+			return 0;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+//Receives one reply, a split reply is put back together first. Returns its length, 0 if it didn't come.
+static size_t ReceiveReply(udp::socket& socket, char* pReply, size_t size)
+{
+	char datagram[2048];
+	auto length = ReceiveDatagram(socket, datagram, sizeof(datagram));
+
+	int32 header = 0;
+	if (length >= sizeof(header))
+		memcpy(&header, datagram, sizeof(header));
+
+	if (header != NET_HEADER_FLAG_SPLITPACKET)
+	{
+		memcpy(pReply, datagram, std::min(length, size));
+		return std::min(length, size);
+	}
+
+	size_t replyLength = 0;
+	uint8 total = 1;
+	for (uint8 received = 0; received < total; ++received)
+	{
+		if (received && !(length = ReceiveDatagram(socket, datagram, sizeof(datagram))))
+			return 0;
+
+		int32 id;
+		uint8 number;
+		bf_read msg(datagram, static_cast<int>(length));
+		if (!SplitPacketHeader::Read(msg, id, total, number))
+			return 0;
+
+		auto pieceLength = length - NET_SPLIT_HEADER_SIZE;
+		if (number * NET_SPLIT_PAYLOAD_SIZE + pieceLength > size)
+			return 0;
+
+		memcpy(pReply + number * NET_SPLIT_PAYLOAD_SIZE, datagram + NET_SPLIT_HEADER_SIZE, pieceLength);
+		replyLength = std::max(replyLength, number * NET_SPLIT_PAYLOAD_SIZE + pieceLength);
+	}
+
+	return replyLength;
+}
+
+//Sends the request Write makes for every client, true if every client gets a reply of the given type
+template<typename WriteRequest, typename ReadReply>
+static bool Exchange(std::vector<udp::socket>& clients, const udp::endpoint& server, char* pReply, size_t size, int replyType,
+	WriteRequest&& write, ReadReply&& read)
+{
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		char request[64];
+		bf_write buf(request, sizeof(request));
+		write(i, buf);
+		clients[i].send_to(asio::buffer(request, buf.GetNumBytesWritten()), server);
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+		auto length = ReceiveReply(clients[i], pReply, size);
+		bf_read msg(pReply, static_cast<int>(length));
+		ok &= length >= 5 && msg.ReadLong() == CONNECTIONLESS_HEADER && msg.ReadByte() == replyType && read(i, msg);
+	}
+
+	return ok;
+}
+
+//Runs a CheckServer with a query worker next to the main thread and sends it every kind of datagram it
+//answers. Once the first round warmed it up, neither the query workers nor the forward queue, the main
+//thread's dispatch, the steam hooks, the transport or the log ring allocate, not even when a new snapshot
+//makes the caches encode their replies again.
+static bool CheckQueryAllocations(const char* netio)
+{
+	//Taken from a socket that is closed again, the workers bind to the port with SO_REUSEPORT
+	asio::io_context clientContext;
+	unsigned short port;
+	{
+		udp::socket probe(clientContext, udp::endpoint(udp::v4(), 0));
+		port = probe.local_endpoint().port();
+	}
+
+	char portArg[8];
+	snprintf(portArg, sizeof(portArg), "%d", static_cast<int>(port));
+	const char* argv[] = { "server-checks", "-version", "1.38.5.5", "-port", portArg, "-threads", "2", "-netio", netio, "-loglevel", "debug" };
+
+	ArgParser parser;
+	parser.AddOption("-version", "", OptionAttr::RequiredWithValue, OptionValueType::STRING);
+	parser.AddOption("-port", "", OptionAttr::RequiredWithValue, OptionValueType::INT16U);
+	parser.AddOption("-rdip", "", OptionAttr::OptionalWithValue, OptionValueType::STRING);
+	parser.AddOption("-mirror", "", OptionAttr::OptionalWithoutValue, OptionValueType::NONE);
+	parser.AddOption("-upstream", "", OptionAttr::OptionalWithValue, OptionValueType::STRING);
+	parser.AddOption("-netio", "", OptionAttr::OptionalWithValue, OptionValueType::STRING, "asio");
+	parser.AddOption("-threads", "", OptionAttr::OptionalWithValue, OptionValueType::INT8U, "1", 1);
+	parser.AddOption("-loglevel", "", OptionAttr::OptionalWithValue, OptionValueType::STRING, "info");
+	parser.ParseArgument(static_cast<int>(sizeof(argv) / sizeof(argv[0])), const_cast<char**>(argv));
+
+	char records[4096];
+	bf_write recordsBuf(records, sizeof(records));
+	WritePlayerRecords(recordsBuf, 60, 0.0f);
+
+	PlayerTable players;
+	players.Decode(records, recordsBuf.GetNumBytesWritten());
+
+	//Snapshots are published outside of the counted part, that's the mirror's job on the main thread
+	auto publish = [&](int round)
+	{
+		ServerInfo info = *GetServerInfoHolder().Load();
+		info.SetServerNumClients(static_cast<uint8_t>(round));
+		info.SavePlayers(players);
+		GetServerInfoHolder().Publish(std::move(info));
+	};
+
+	//Every round comes from new sources, so the rate limiter takes them in too. The kernel spreads
+	//the sources over both listen sockets, the main thread gets the steam packets of the query worker
+	//through the forward queue.
+	constexpr int numRounds = 4;
+	constexpr int numClients = 16;
+	std::vector<udp::socket> rounds[numRounds];
+	for (int round = 0; round < numRounds; ++round)
+	{
+		for (int i = 0; i < numClients; ++i)
+		{
+			auto& client = rounds[round].emplace_back(clientContext, udp::endpoint(make_address_v4(0x7F000000 + (round + 1) * 256 + i + 1), 0));
+			client.non_blocking(true);
+		}
+	}
+
+	publish(0);
+
+	CheckServer server(parser);
+	server.StartListening();
+	std::thread serverThread([&] { server.RunServer(); });
+
+	//The listen sockets are opened on the server thread, ask from a source of its own until it answers
+	udp::socket probe(clientContext, udp::endpoint(make_address_v4("127.0.100.1"), 0));
+	probe.non_blocking(true);
+	bool listening = false;
+	for (int i = 0; i < 10 && !listening; ++i)
+	{
+		char request[64], answer[64];
+		bf_write buf(request, sizeof(request));
+		A2sInfoRequest::Write(buf);
+		probe.send_to(asio::buffer(request, buf.GetNumBytesWritten()), udp::endpoint(address_v4::loopback(), port));
+		listening = ReceiveDatagram(probe, answer, sizeof(answer)) > 0;
+	}
+
+	auto reply = std::make_unique<char[]>(MAX_SPLIT_REPLY_SIZE);
+	udp::endpoint to(address_v4::loopback(), port);
+	int32 challenges[numClients];
+	bool ok = listening;
+
+	for (int round = 0; round < numRounds && ok; ++round)
+	{
+		auto& clients = rounds[round];
+		publish(round);
+
+		//The first round warms up whatever is set up lazily
+		auto before = g_NumAllocations.load(std::memory_order_relaxed);
+
+		auto any = [](size_t, bf_read&) { return true; };
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, S2C_CHALLENGE,
+			[](size_t, bf_write& buf) { A2sInfoRequest::Write(buf); },
+			[&](size_t i, bf_read& msg) { return S2cQueryChallengeBody::Read(msg, challenges[i]); });
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, S2A_INFO_SRC,
+			[&](size_t i, bf_write& buf) { A2sInfoChallengedRequest::Write(buf, challenges[i]); }, any);
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, S2A_PLAYER,
+			[&](size_t i, bf_write& buf) { A2sPlayerRequest::Write(buf, challenges[i]); },
+			[](size_t, bf_read& msg) { return msg.ReadByte() == 60; });
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, A2A_ACK,
+			[](size_t, bf_write& buf) { buf.WriteLong(CONNECTIONLESS_HEADER); buf.WriteByte(A2A_PING); }, any);
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, S2C_CHALLENGE,
+			[](size_t, bf_write& buf) { buf.WriteLong(CONNECTIONLESS_HEADER); buf.WriteByte(A2S_GETCHALLENGE); buf.WriteString("connect0x00000000"); }, any);
+		ok &= Exchange(clients, to, reply.get(), MAX_SPLIT_REPLY_SIZE, S2C_CONNREJECT,
+			[](size_t, bf_write& buf) { buf.WriteLong(CONNECTIONLESS_HEADER); buf.WriteByte(C2S_CONNECT); }, any);
+
+		auto allocations = g_NumAllocations.load(std::memory_order_relaxed) - before;
+		if (round && allocations)
+		{
+			printf("%llu heap allocations answering round %d with -netio %s\n", static_cast<unsigned long long>(allocations), round, netio);
+			ok = false;
+		}
+	}
+
+	server.StopServer();
+	serverThread.join();
+	return ok;
+}
+
+//Stands in for an upstream that never answers, notes when every A2S_INFO arrives
+static asio::awaitable<void> CountInfoRequests(asio::io_context& context, asio::ip::udp::socket& socket, std::chrono::steady_clock::time_point* pTimes, int count)
+{
+	char buf[64];
+	for (int i = 0; i < count;)
+	{
+		asio::error_code ec;
+		auto length = co_await socket.async_receive(asio::buffer(buf), asio::redirect_error(asio::use_awaitable, ec));
+		if (ec)
+			co_return;
+
+		if (length > 4 && buf[4] == A2S_INFO)
+			pTimes[i++] = std::chrono::steady_clock::now();
+	}
+
+	context.stop();
+}
+
+//A poll of an upstream that never answers ends at the timeout and the next one goes out on time.
+//Takes as long as the two polls, a few seconds.
+static bool CheckMirrorTimeout()
+{
+	asio::io_context context;
+	asio::ip::udp::socket upstream(context, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+	std::chrono::steady_clock::time_point times[2];
+	asio::co_spawn(context, CountInfoRequests(context, upstream, times, 2), asio::detached);
+
+	char list[32];
+	snprintf(list, sizeof(list), "127.0.0.1:%d", static_cast<int>(upstream.local_endpoint().port()));
+
+	MirrorCluster cluster(context);
+	if (cluster.Start(list) != 1)
+		return false;
+
+	//Nothing changed, so the second poll starts twice the shortest interval after the first
+	constexpr auto expected = std::chrono::seconds(CONFIG_MIRROR_MIN_INTERVAL_SECONDS * 2);
+	context.run_for(expected + std::chrono::milliseconds(CONFIG_MIRROR_TIMEOUT_MS));
+
+	auto between = times[1] - times[0];
+	return times[1] != std::chrono::steady_clock::time_point()
+		&& between > expected - std::chrono::milliseconds(100) && between < expected + std::chrono::milliseconds(500);
+}
+
+//Without arguments every check runs, with a -netio mode only the query check runs on that transport
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		if (!CheckQueryAllocations(argv[1]))
+		{
+			printf("Answering queries with -netio %s allocates once the server is warmed up\n", argv[1]);
+			return EXIT_FAILURE;
+		}
+
+		printf("All server checks passed\n");
+		return EXIT_SUCCESS;
+	}
+
+	bool ok = true;
+
+	if (!CheckPlayerTable())
+	{
+		printf("The player table doesn't encode the players it decoded\n");
+		ok = false;
+	}
+
+	if (!CheckServerInfoStrings())
+	{
+		printf("Setting a string that doesn't fit changes the server info every time\n");
+		ok = false;
+	}
+
+	if (!CheckQueryAllocations("asio"))
+	{
+		printf("Answering queries with -netio asio allocates once the server is warmed up\n");
+		ok = false;
+	}
+
+	if (!CheckMirrorTimeout())
+	{
+		printf("Polling an upstream that never answers doesn't end at the timeout\n");
+		ok = false;
+	}
+
+	if (!ok)
+		return EXIT_FAILURE;
+
+	printf("All server checks passed\n");
+	return EXIT_SUCCESS;
+}